@@ -0,0 +1,96 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "memory.h"
+
+#define ARENA_ROUND(x) (((x) + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1))
+// Every allocation is preceded by its size, so realloc() knows what to copy
+#define ARENA_HEADER       ARENA_ALIGNMENT
+#define ARENA_BLOCK_HEADER ARENA_ROUND(sizeof(Block))
+
+Arena::Arena() : blocks(NULL) {}
+
+Arena::~Arena() {
+    while (blocks) {
+        Block *next = blocks->next;
+        memory_free(blocks);
+        blocks = next;
+    }
+}
+
+void *Arena::alloc(size_t size) {
+    size_t needed = ARENA_HEADER + ARENA_ROUND(size);
+    if (!blocks || blocks->used + needed > blocks->size) {
+        size_t blockSize = (needed > ARENA_BLOCK_SIZE) ? needed : ARENA_BLOCK_SIZE;
+        Block *block = (Block *) memory_alloc(MEMORY_MEM2, ARENA_BLOCK_HEADER + blockSize, ARENA_ALIGNMENT);
+        if (!block)
+            return NULL;
+        block->next = blocks;
+        block->size = blockSize;
+        block->used = 0;
+        blocks = block;
+    }
+
+    uint8_t *p = (uint8_t *) blocks + ARENA_BLOCK_HEADER + blocks->used;
+    *(size_t *) p = size;
+    blocks->used += needed;
+    return p + ARENA_HEADER;
+}
+
+void *Arena::realloc(void *ptr, size_t size) {
+    if (!ptr)
+        return alloc(size);
+
+    size_t oldSize = *(size_t *) ((uint8_t *) ptr - ARENA_HEADER);
+    if (size <= oldSize)
+        return ptr;
+
+    // The newest allocation can grow in place, which is what miniz's arrays do
+    uint8_t *end = (uint8_t *) ptr + ARENA_ROUND(oldSize);
+    if (end == (uint8_t *) blocks + ARENA_BLOCK_HEADER + blocks->used &&
+        blocks->used + ARENA_ROUND(size) - ARENA_ROUND(oldSize) <= blocks->size) {
+        blocks->used += ARENA_ROUND(size) - ARENA_ROUND(oldSize);
+        *(size_t *) ((uint8_t *) ptr - ARENA_HEADER) = size;
+        return ptr;
+    }
+
+    void *p = alloc(size);
+    if (p)
+        memcpy(p, ptr, oldSize);
+    return p;
+}
+
+void Arena::reset() {
+    if (!blocks)
+        return;
+
+    // Keep the newest block for the next archive
+    Block *block = blocks->next;
+    while (block) {
+        Block *next = block->next;
+        memory_free(block);
+        block = next;
+    }
+    blocks->next = NULL;
+    blocks->used = 0;
+}
+
+void Arena::install(mz_zip_archive *zip) {
+    zip->m_pAlloc = zipAlloc;
+    zip->m_pFree = zipFree;
+    zip->m_pRealloc = zipRealloc;
+    zip->m_pAlloc_opaque = this;
+}
+
+void *Arena::zipAlloc(void *opaque, size_t items, size_t size) {
+    return ((Arena *) opaque)->alloc(items * size);
+}
+
+void Arena::zipFree(void *opaque, void *address) {
+}
+
+void *Arena::zipRealloc(void *opaque, void *address, size_t items, size_t size) {
+    return ((Arena *) opaque)->realloc(address, items * size);
+}
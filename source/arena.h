@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "miniz/miniz.h"
+
+#define ARENA_BLOCK_SIZE (64 * 1024) // 64 KB
+#define ARENA_ALIGNMENT  16
+
+// Bump allocator for the allocations miniz makes while an archive is open.
+// Nothing is freed on its own, everything goes at once in reset(), which
+// keeps the first block around for the next archive.
+class Arena {
+public:
+    Arena();
+    ~Arena();
+
+    void *alloc(size_t size);
+    void *realloc(void *ptr, size_t size);
+    void reset();
+
+    // Routes the archive's m_pAlloc, m_pFree and m_pRealloc to this arena
+    void install(mz_zip_archive *zip);
+
+private:
+    typedef struct Block {
+        Block *next;
+        size_t size;
+        size_t used;
+    } Block;
+
+    static void *zipAlloc(void *opaque, size_t items, size_t size);
+    static void zipFree(void *opaque, void *address);
+    static void *zipRealloc(void *opaque, void *address, size_t items, size_t size);
+
+    Block *blocks;
+};
@@ -0,0 +1,253 @@
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CRC32_X86
+#elif defined(__aarch64__) && defined(__linux__)
+#include <arm_acle.h>
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#define CRC32_ARMV8
+#endif
+
+#include "crc32.h"
+#include "memory.h"
+#include "miniz/miniz.h"
+
+#define CRC32_POLY 0xEDB88320
+
+typedef uint32_t (*Crc32Kernel)(uint32_t crc, const uint8_t *p, size_t size);
+
+// Table k holds the CRC of a byte followed by k zero bytes, so slicing-by-n
+// can look up n bytes independently and xor the results
+typedef struct Crc32Tables {
+    uint32_t table[16][256];
+
+    constexpr Crc32Tables() : table() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int j = 0; j < 8; j++)
+                crc = (crc >> 1) ^ ((crc & 1) ? CRC32_POLY : 0);
+            table[0][i] = crc;
+        }
+        for (int k = 1; k < 16; k++) {
+            for (uint32_t i = 0; i < 256; i++)
+                table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+        }
+    }
+} Crc32Tables;
+
+static constexpr Crc32Tables tables;
+
+typedef uint32_t Crc32Table[256];
+
+// The tables the byte loop and slicing-by-8 read, moved to MEM1 on the console
+static const Crc32Table *sliceTables = tables.table;
+
+static inline uint32_t readLE32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    // A single lwbrx on PowerPC
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static uint32_t crc32Bytes(uint32_t crc, const uint8_t *p, size_t size) {
+    while (size--)
+        crc = (crc >> 8) ^ sliceTables[0][(crc ^ *p++) & 0xFF];
+    return crc;
+}
+
+// Reads only the first 8 of the 16 KB of tables, which leaves room in the
+// Espresso's 32 KB L1 for the inflate state and the data itself
+static uint32_t crc32Slice8(uint32_t crc, const uint8_t *p, size_t size) {
+    const Crc32Table *t = sliceTables;
+    while (size >= 8) {
+        uint32_t one = readLE32(p) ^ crc;
+        uint32_t two = readLE32(p + 4);
+        crc = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^ t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24] ^
+              t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF] ^ t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+        p += 8;
+        size -= 8;
+    }
+    return crc32Bytes(crc, p, size);
+}
+
+#if !defined(__WIIU__) || defined(CRC32_X86)
+// All 16 KB of tables, for hosts with bigger caches and the PCLMULQDQ tail
+static uint32_t crc32Slice16(uint32_t crc, const uint8_t *p, size_t size) {
+    const uint32_t(*t)[256] = tables.table;
+    while (size >= 16) {
+        uint32_t one = readLE32(p) ^ crc;
+        uint32_t two = readLE32(p + 4);
+        uint32_t three = readLE32(p + 8);
+        uint32_t four = readLE32(p + 12);
+        crc = t[15][one & 0xFF] ^ t[14][(one >> 8) & 0xFF] ^ t[13][(one >> 16) & 0xFF] ^ t[12][one >> 24] ^
+              t[11][two & 0xFF] ^ t[10][(two >> 8) & 0xFF] ^ t[9][(two >> 16) & 0xFF] ^ t[8][two >> 24] ^
+              t[7][three & 0xFF] ^ t[6][(three >> 8) & 0xFF] ^ t[5][(three >> 16) & 0xFF] ^ t[4][three >> 24] ^
+              t[3][four & 0xFF] ^ t[2][(four >> 8) & 0xFF] ^ t[1][(four >> 16) & 0xFF] ^ t[0][four >> 24];
+        p += 16;
+        size -= 16;
+    }
+    return crc32Slice8(crc, p, size);
+}
+#endif
+
+#ifdef CRC32_X86
+// Folds 64 bytes at a time with carry-less multiplies, then reduces to
+// 32 bits with a Barrett reduction. Needs at least 64 bytes, a multiple of 16.
+__attribute__((target("pclmul,sse4.1"))) static uint32_t crc32FoldPclmul(uint32_t crc, const uint8_t *p, size_t size) {
+    alignas(16) static const uint64_t k1k2[] = {0x0154442BD4, 0x01C6E41596};
+    alignas(16) static const uint64_t k3k4[] = {0x01751997D0, 0x00CCAA009E};
+    alignas(16) static const uint64_t k5k0[] = {0x0163CD6124, 0x0000000000};
+    alignas(16) static const uint64_t poly[] = {0x01DB710641, 0x01F7011641};
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    x1 = _mm_loadu_si128((const __m128i *) (p + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *) (p + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *) (p + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *) (p + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+    x0 = _mm_load_si128((const __m128i *) k1k2);
+    p += 64;
+    size -= 64;
+
+    while (size >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *) (p + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *) (p + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *) (p + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *) (p + 0x30)));
+        p += 64;
+        size -= 64;
+    }
+
+    // Fold the four lanes into one
+    x0 = _mm_load_si128((const __m128i *) k3k4);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    while (size >= 16) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i *) p)), x5);
+        p += 16;
+        size -= 16;
+    }
+
+    // 128 to 64 bits
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x0 = _mm_loadl_epi64((const __m128i *) k5k0);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, x0, 0x00), x2);
+
+    // Barrett reduction to 32 bits
+    x0 = _mm_load_si128((const __m128i *) poly);
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    return (uint32_t) _mm_extract_epi32(x1, 1);
+}
+
+static uint32_t crc32Pclmul(uint32_t crc, const uint8_t *p, size_t size) {
+    if (size >= 64) {
+        size_t folded = size & ~(size_t) 15;
+        crc = crc32FoldPclmul(crc, p, folded);
+        p += folded;
+        size -= folded;
+    }
+    return crc32Slice16(crc, p, size);
+}
+#endif
+
+#ifdef CRC32_ARMV8
+__attribute__((target("+crc"))) static uint32_t crc32Armv8(uint32_t crc, const uint8_t *p, size_t size) {
+    while (size && ((uintptr_t) p & 7)) {
+        crc = __crc32b(crc, *p++);
+        size--;
+    }
+    while (size >= 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        crc = __crc32d(crc, v);
+        p += 8;
+        size -= 8;
+    }
+    while (size--)
+        crc = __crc32b(crc, *p++);
+    return crc;
+}
+#endif
+
+static const char *kernelName;
+
+static Crc32Kernel selectKernel() {
+#if defined(CRC32_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) {
+        kernelName = "pclmul";
+        return crc32Pclmul;
+    }
+#elif defined(CRC32_ARMV8)
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+        kernelName = "armv8";
+        return crc32Armv8;
+    }
+#endif
+#ifdef __WIIU__
+    // The heaps exist already, memory_init() runs before static initialization
+    Crc32Table *copy = (Crc32Table *) memory_alloc(MEMORY_MEM1, 8 * sizeof(Crc32Table));
+    if (copy) {
+        memcpy(copy, tables.table, 8 * sizeof(Crc32Table));
+        sliceTables = copy;
+    }
+    kernelName = "slice8";
+    return crc32Slice8;
+#else
+    kernelName = "slice16";
+    return crc32Slice16;
+#endif
+}
+
+// Chosen during static initialization, before any extraction thread exists
+static const Crc32Kernel kernel = selectKernel();
+
+uint32_t crc32_update(uint32_t crc, const void *data, size_t size) {
+    if (!data)
+        return CRC32_INIT;
+    return ~kernel(~crc, (const uint8_t *) data, size);
+}
+
+const char *crc32_kernel() {
+    return kernelName;
+}
+
+#ifdef USE_EXTERNAL_MZCRC
+// Stands in for miniz's own table loop, which also puts these kernels behind
+// TINFL_FLAG_COMPUTE_CRC32
+mz_ulong mz_crc32(mz_ulong crc, const mz_uint8 *ptr, size_t buf_len) {
+    return crc32_update((uint32_t) crc, ptr, buf_len);
+}
+#endif
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CRC32_INIT 0
+
+// CRC-32 as used by ZIP, with the same conventions as mz_crc32(): start with
+// CRC32_INIT and pass the previous result back in for the next chunk.
+// The kernel is chosen once at startup: slicing-by-8 on the console, and
+// PCLMULQDQ, the ARMv8 CRC instructions or slicing-by-16 on a host build.
+uint32_t crc32_update(uint32_t crc, const void *data, size_t size);
+
+// Name of the kernel crc32_update() uses
+const char *crc32_kernel();
@@ -0,0 +1,437 @@
+#include <whb/log.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "download.h"
+#include "extract.h"
+#include "memory.h"
+#include "thread.h"
+
+#define IO_BUFSIZE (128 * 1024) // 128 KB
+
+static int initSocket(void *ptr, curl_socket_t socket, curlsocktype type) {
+    int o = 1;
+
+    // Activate WinScale
+    int r = setsockopt(socket, SOL_SOCKET, SO_WINSCALE, &o, sizeof(o));
+    if (r != 0) {
+        WHBLogPrintf("initSocket: Error setting WinScale: %d", r);
+        return CURL_SOCKOPT_ERROR;
+    }
+
+    // Activate TCP SAck
+    r = setsockopt(socket, SOL_SOCKET, SO_TCPSACK, &o, sizeof(o));
+    if (r != 0) {
+        WHBLogPrintf("initSocket: Error setting TCP SAck: %d", r);
+        return CURL_SOCKOPT_ERROR;
+    }
+
+    // Disable slowstart. Should be more important fo a server but doesn't hurt a
+    // client, too
+    r = setsockopt(socket, SOL_SOCKET, 0x4000, &o, sizeof(o));
+    if (r != 0) {
+        WHBLogPrintf("initSocket: Error setting Noslowstart: %d", r);
+        return CURL_SOCKOPT_ERROR;
+    }
+
+    o = 0;
+    // Disable TCP keepalive - libCURL default
+    r = setsockopt(socket, SOL_SOCKET, SO_KEEPALIVE, &o, sizeof(o));
+    if (r != 0) {
+        WHBLogPrintf("initSocket: Error setting TCP nodelay: %d", r);
+        return CURL_SOCKOPT_ERROR;
+    }
+
+    o = IO_BUFSIZE;
+    // Set receive buffersize
+    r = setsockopt(socket, SOL_SOCKET, SO_RCVBUF, &o, sizeof(o));
+    if (r != 0) {
+        WHBLogPrintf("initSocket: Error setting RBS: %d", r);
+        return CURL_SOCKOPT_ERROR;
+    }
+
+    return CURL_SOCKOPT_OK;
+}
+
+static size_t writefunction(void *ptr, size_t size, size_t nmemb,
+                            void *stream) {
+    if (!((AsyncWriter *) stream)->write(ptr, size * nmemb))
+        return 0;
+    return size * nmemb;
+}
+
+DownloadBuffer::DownloadBuffer(size_t limit) : buffer(NULL), length(0), capacity(0), limit(limit) {}
+
+DownloadBuffer::~DownloadBuffer() {
+    memory_free(buffer);
+}
+
+bool DownloadBuffer::append(const void *ptr, size_t size) {
+    if (size > limit - length)
+        return false;
+    if (length + size > capacity) {
+        size_t grown = capacity ? capacity : DOWNLOAD_BUFFER_INITIAL;
+        while (grown < length + size)
+            grown *= 2;
+        if (grown > limit)
+            grown = limit;
+        uint8_t *resized = (uint8_t *) memory_realloc(MEMORY_MEM2, buffer, grown);
+        if (!resized)
+            return false;
+        buffer = resized;
+        capacity = grown;
+    }
+    memcpy(buffer + length, ptr, size);
+    length += size;
+    return true;
+}
+
+void DownloadBuffer::clear() {
+    memory_free(buffer);
+    buffer = NULL;
+    length = capacity = limit = 0;
+}
+
+size_t download_memory_limit() {
+    size_t avail = memory_allocatable(MEMORY_MEM2);
+    if (avail <= DOWNLOAD_MEMORY_RESERVE)
+        return 0;
+    // Growing from half the limit to all of it needs both copies at once
+    return (avail - DOWNLOAD_MEMORY_RESERVE) / 3 * 2;
+}
+
+static void getHost(const char *url, char *host, size_t size) {
+    const char *start = strstr(url, "://");
+    start = start ? start + 3 : url;
+    size_t len = strcspn(start, "/?#");
+    if (len >= size)
+        len = size - 1;
+    memcpy(host, start, len);
+    host[len] = '\0';
+}
+
+DownloadSession::DownloadSession() : initialized(false), share(NULL), multi(NULL), numHandles(0),
+                                     numJobs(0), firstJob(0) {
+    CURLcode res = curl_global_init(CURL_GLOBAL_DEFAULT);
+    if (res != CURLE_OK) {
+        WHBLogPrintf("curl_global_init: %d", res);
+        return;
+    }
+    initialized = true;
+
+    // Everything runs on one thread, so the share handle needs no lock callbacks
+    share = curl_share_init();
+    if (share) {
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    }
+
+    multi = curl_multi_init();
+    if (!multi)
+        WHBLogPrint("curl_multi_init: failed");
+}
+
+DownloadSession::~DownloadSession() {
+    close();
+}
+
+void DownloadSession::close() {
+    for (int i = firstJob; i < numJobs; i++) {
+        delete jobs[i].file;
+    }
+    firstJob = numJobs = 0;
+
+    for (int i = 0; i < numHandles; i++)
+        curl_easy_cleanup(handles[i].curl);
+    numHandles = 0;
+
+    if (multi) {
+        curl_multi_cleanup(multi);
+        multi = NULL;
+    }
+
+    if (share) {
+        curl_share_cleanup(share);
+        share = NULL;
+    }
+
+    if (initialized) {
+        curl_global_cleanup();
+        initialized = false;
+    }
+}
+
+DownloadSession::HostHandle *DownloadSession::acquireHandle(const char *url) {
+    char host[MAX_HOSTNAME];
+    getHost(url, host, sizeof(host));
+
+    // Prefer an idle handle which last talked to the same host
+    HostHandle *idle = NULL;
+    for (int i = 0; i < numHandles; i++) {
+        if (handles[i].busy)
+            continue;
+        if (strcmp(handles[i].host, host) == 0) {
+            handles[i].busy = true;
+            return &handles[i];
+        }
+        idle = &handles[i];
+    }
+
+    if (numHandles < MAX_SESSION_HANDLES) {
+        // Start a curl session
+        CURL *curl = curl_easy_init();
+        if (!curl) {
+            WHBLogPrint("curl_easy_init: failed");
+            return NULL;
+        }
+
+        if (share)
+            curl_easy_setopt(curl, CURLOPT_SHARE, share);
+
+        // Enable optimizations
+        curl_easy_setopt(curl, CURLOPT_SOCKOPTFUNCTION, initSocket);
+
+        // Follow redirects
+        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+
+        idle = &handles[numHandles++];
+        idle->curl = curl;
+    }
+
+    // Connections live in the share handle, so any idle handle can take over
+    if (idle) {
+        strcpy(idle->host, host);
+        idle->busy = true;
+    }
+    return idle;
+}
+
+int DownloadSession::add(const char *url, const char *cert, DownloadCallback callback, void *data,
+                         DownloadSizeCallback sizeCallback) {
+    // Results of the previous run are only kept until something new is queued
+    if (firstJob == numJobs)
+        firstJob = numJobs = 0;
+    if (numJobs == MAX_SESSION_JOBS)
+        return -1;
+
+    DownloadJob *job = &jobs[numJobs];
+    job->url = url;
+    job->cert = cert;
+    job->callback = callback;
+    job->data = data;
+    job->sizeCallback = sizeCallback;
+    job->file = NULL;
+    job->memory = NULL;
+    job->path = NULL;
+    job->handle = NULL;
+    job->result = -1;
+    return numJobs++;
+}
+
+AsyncWriter *DownloadSession::openFile(const char *path) {
+    char dir[MAX_FILENAME];
+    const char *last = strrchr(path, '/');
+    if (last && last != path && (size_t) (last - path) < sizeof(dir)) {
+        memcpy(dir, path, last - path);
+        dir[last - path] = '\0';
+        mkdir_p(dir, 0777);
+    }
+
+    // Written on another core, so SD stalls don't hold up the sockets
+    AsyncWriter *file = new AsyncWriter();
+    if (!file->open(path, Thread::currentCore() + 1)) {
+        WHBLogPrintf("Error creating file: %s", path);
+        delete file;
+        return NULL;
+    }
+    return file;
+}
+
+// Receives into the job's memory buffer, and moves what it has to the file
+// once the buffer is full
+size_t DownloadSession::writeMemory(void *ptr, size_t size, size_t nmemb, void *data) {
+    DownloadJob *job = (DownloadJob *) data;
+    if (job->memory && job->memory->append(ptr, size * nmemb))
+        return size * nmemb;
+
+    if (!job->file) {
+        job->file = openFile(job->path);
+        if (!job->file)
+            return 0;
+        if (job->memory) {
+            WHBLogPrintf("Not enough memory for %s, writing it to a file", job->path);
+            bool ok = job->file->write(job->memory->data(), job->memory->size());
+            job->memory->clear();
+            job->memory = NULL;
+            if (!ok)
+                return 0;
+        }
+    }
+    return writefunction(ptr, size, nmemb, job->file);
+}
+
+// Hands the job's size callback the Content-Length of the response which is
+// actually received, redirects aren't passed on, then clears it so later
+// data goes straight to the job's own callback
+size_t DownloadSession::writeSized(void *ptr, size_t size, size_t nmemb, void *data) {
+    DownloadJob *job = (DownloadJob *) data;
+    if (job->sizeCallback) {
+        curl_off_t length = -1;
+        if (curl_easy_getinfo(job->handle->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length) == CURLE_OK &&
+            length >= 0 && !job->sizeCallback((uint64_t) length, job->data))
+            return 0;
+        job->sizeCallback = NULL;
+    }
+    return job->callback(ptr, size, nmemb, job->data);
+}
+
+int DownloadSession::addFile(const char *url, const char *path, const char *cert, DownloadBuffer *memory) {
+    if (memory) {
+        int id = add(url, cert, writeMemory, NULL);
+        if (id < 0)
+            return -1;
+        jobs[id].data = &jobs[id];
+        jobs[id].memory = memory;
+        jobs[id].path = path;
+        return id;
+    }
+
+    AsyncWriter *file = openFile(path);
+    if (!file)
+        return -1;
+    int id = add(url, cert, writefunction, file);
+    if (id < 0) {
+        delete file;
+        return -1;
+    }
+    jobs[id].file = file;
+    return id;
+}
+
+bool DownloadSession::start(DownloadJob *job) {
+    job->handle = acquireHandle(job->url);
+    if (!job->handle)
+        return false;
+
+    CURL *curl = job->handle->curl;
+
+    // Use the certificate bundle in the romfs
+    curl_easy_setopt(curl, CURLOPT_CAINFO, job->cert);
+
+    // Set the custom write function
+    if (job->sizeCallback) {
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeSized);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, job);
+    } else {
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, job->callback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, job->data);
+    }
+
+    // Set the download URL
+    curl_easy_setopt(curl, CURLOPT_URL, job->url);
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, job);
+
+    if (curl_multi_add_handle(multi, curl) != CURLM_OK) {
+        job->handle->busy = false;
+        job->handle = NULL;
+        return false;
+    }
+    return true;
+}
+
+void DownloadSession::finish(DownloadJob *job, CURLcode res) {
+    if (job->handle) {
+        curl_multi_remove_handle(multi, job->handle->curl);
+        job->handle->busy = false;
+        job->handle = NULL;
+    }
+
+    if (res != CURLE_OK)
+        WHBLogPrintf("curl_easy_perform: %d", res);
+    job->result = (res == CURLE_OK) ? 0 : 1;
+
+    // close the header file
+    if (job->file) {
+        if (!job->file->close())
+            job->result = 1;
+        delete job->file;
+        job->file = NULL;
+    }
+}
+
+int DownloadSession::run(int maxConcurrent) {
+    int next = firstJob, active = 0, failed = 0;
+
+    if (maxConcurrent < 1)
+        maxConcurrent = 1;
+    if (maxConcurrent > MAX_SESSION_HANDLES)
+        maxConcurrent = MAX_SESSION_HANDLES;
+
+    while (next < numJobs || active) {
+        while (active < maxConcurrent && next < numJobs) {
+            DownloadJob *job = &jobs[next++];
+            if (initialized && multi && start(job)) {
+                active++;
+            } else {
+                finish(job, CURLE_FAILED_INIT);
+                failed++;
+            }
+        }
+        if (!active)
+            continue;
+
+        int running = 0;
+        CURLMcode mc = curl_multi_perform(multi, &running);
+        if (mc != CURLM_OK) {
+            WHBLogPrintf("curl_multi_perform: %d", mc);
+            for (int i = firstJob; i < next; i++) {
+                if (jobs[i].handle) {
+                    finish(&jobs[i], CURLE_FAILED_INIT);
+                    failed++;
+                }
+            }
+            for (; next < numJobs; next++, failed++)
+                finish(&jobs[next], CURLE_FAILED_INIT);
+            break;
+        }
+
+        CURLMsg *msg;
+        int queued;
+        while ((msg = curl_multi_info_read(multi, &queued))) {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+
+            DownloadJob *job = NULL;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &job);
+            finish(job, msg->data.result);
+            active--;
+            if (job->result != 0)
+                failed++;
+        }
+
+        if (running)
+            curl_multi_wait(multi, NULL, 0, 100, NULL);
+    }
+
+    firstJob = numJobs;
+    return failed;
+}
+
+int DownloadSession::download(const char *url, const char *cert, DownloadCallback callback, void *data) {
+    int id = add(url, cert, callback, data);
+    if (id < 0)
+        return 1;
+    run(1);
+    return result(id);
+}
+
+int DownloadSession::downloadFile(const char *url, const char *path, const char *cert, DownloadBuffer *memory) {
+    int id = addFile(url, path, cert, memory);
+    if (id < 0)
+        return 1;
+    run(1);
+    return result(id);
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <curl/curl.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "filewriter.h"
+
+#define MAX_SESSION_HANDLES 8
+#define MAX_SESSION_JOBS    16
+#define MAX_HOSTNAME        128
+
+// MEM2 left free for extracting an archive which was downloaded into memory:
+// the workers' buffers, pipelined entries and parallel inflate
+#define DOWNLOAD_MEMORY_RESERVE (48 * 1024 * 1024) // 48 MB
+// First allocation of a DownloadBuffer, doubled whenever it fills up
+#define DOWNLOAD_BUFFER_INITIAL (1024 * 1024) // 1 MB
+
+typedef size_t (*DownloadCallback)(void *ptr, size_t size, size_t nmemb, void *data);
+// Gets the size of the body before any of it, if the server sent one.
+// Returning false cancels the download.
+typedef bool (*DownloadSizeCallback)(uint64_t size, void *data);
+
+// Growable buffer a download is received into instead of a file, as long as
+// it stays below its limit
+class DownloadBuffer {
+public:
+    explicit DownloadBuffer(size_t limit);
+    ~DownloadBuffer();
+
+    // False if size more bytes would go over the limit or can't be allocated
+    bool append(const void *ptr, size_t size);
+    // Frees the contents, the buffer can't be appended to after that
+    void clear();
+    const uint8_t *data() const { return buffer; }
+    size_t size() const { return length; }
+
+private:
+    uint8_t *buffer;
+    size_t length;
+    size_t capacity;
+    size_t limit;
+};
+
+// How big a download may get in memory right now: a part of what the MEM2
+// heap can still hand out, leaving DOWNLOAD_MEMORY_RESERVE free. 0 if
+// there isn't enough memory to bother.
+size_t download_memory_limit();
+
+// Owns the curl state for a whole install run: one global init, a share
+// handle for DNS, connections and TLS sessions, and a pool of easy handles
+// keyed by host so later downloads from the same server reuse its
+// connection. Queued downloads run concurrently through a multi handle.
+class DownloadSession {
+public:
+    DownloadSession();
+    ~DownloadSession();
+
+    // Queues a download and returns its id, or -1 if the queue is full
+    int add(const char *url, const char *cert, DownloadCallback callback, void *data,
+            DownloadSizeCallback sizeCallback = NULL);
+    // Queues a download into path, creating its parent directories. With a
+    // memory buffer, the body is kept in there instead and only written to
+    // path if it outgrows the buffer, which is cleared then.
+    int addFile(const char *url, const char *path, const char *cert, DownloadBuffer *memory = NULL);
+    // Runs every queued download, at most maxConcurrent at a time, and
+    // returns the number of failed ones
+    int run(int maxConcurrent);
+    // Result of a finished download: 0 on success, 1 on failure. Only valid
+    // until the next add(), which starts reusing the slots of a finished run.
+    int result(int id) const { return jobs[id].result; }
+
+    int download(const char *url, const char *cert, DownloadCallback callback, void *data);
+    int downloadFile(const char *url, const char *path, const char *cert, DownloadBuffer *memory = NULL);
+    void close();
+
+private:
+    typedef struct HostHandle {
+        char host[MAX_HOSTNAME];
+        CURL *curl;
+        bool busy;
+    } HostHandle;
+
+    typedef struct DownloadJob {
+        const char *url;
+        const char *cert;
+        DownloadCallback callback;
+        void *data;
+        DownloadSizeCallback sizeCallback;
+        AsyncWriter *file;
+        // Until the body outgrows it, then file takes over
+        DownloadBuffer *memory;
+        const char *path;
+        HostHandle *handle;
+        int result;
+    } DownloadJob;
+
+    static AsyncWriter *openFile(const char *path);
+    static size_t writeMemory(void *ptr, size_t size, size_t nmemb, void *data);
+    static size_t writeSized(void *ptr, size_t size, size_t nmemb, void *data);
+
+    HostHandle *acquireHandle(const char *url);
+    bool start(DownloadJob *job);
+    void finish(DownloadJob *job, CURLcode res);
+
+    bool initialized;
+    CURLSH *share;
+    CURLM *multi;
+    HostHandle handles[MAX_SESSION_HANDLES];
+    int numHandles;
+    DownloadJob jobs[MAX_SESSION_JOBS];
+    int numJobs;
+    int firstJob;
+};
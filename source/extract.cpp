@@ -0,0 +1,1103 @@
+#include <whb/log.h>
+
+#include <errno.h>
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "arena.h"
+#include "crc32.h"
+#include "extract.h"
+#include "filewriter.h"
+#include "inflate.h"
+#include "memory.h"
+#include "pinflate.h"
+#include "thread.h"
+#include "zipreader.h"
+
+#define ZIP_LOCAL_HEADER_SIG   0x04034b50
+#define ZIP_CENTRAL_HEADER_SIG 0x02014b50
+#define ZIP_END_HEADER_SIG     0x06054b50
+#define ZIP64_END_HEADER_SIG   0x06064b50
+#define ZIP_DESCRIPTOR_SIG     0x08074b50
+
+#define ZIP_FLAG_ENCRYPTED        0x0001
+#define ZIP_FLAG_DATA_DESCRIPTOR  0x0008
+#define ZIP_FLAG_STRONG_ENCRYPTED 0x0040
+
+#define EXTRACT_THREADS THREAD_NUM_CORES
+// Creating, reserving and closing a file take about as long as writing
+// this much, for splitting the entries evenly between the workers
+#define EXTRACT_FILE_COST (64 * 1024) // 64 KB
+// Compressed size from which an entry is read, inflated and written by
+// three threads, each on its own core. These are extracted one at a time
+// before the workers start, so nothing else competes for the cores.
+#define EXTRACT_PIPELINE_SIZE (4 * 1024 * 1024) // 4 MB
+// Output windows of a pipelined entry: one being inflated into, one queued
+// and one being written
+#define EXTRACT_PIPELINE_WINDOWS 3
+// Deflated entries from this compressed size on are inflated on all cores,
+// while they're extracted before the workers. Up to EXTRACT_PARALLEL_MAX,
+// their data is read into memory for that.
+#define EXTRACT_PARALLEL_SIZE (8 * 1024 * 1024)  // 8 MB
+#define EXTRACT_PARALLEL_MAX  (64 * 1024 * 1024) // 64 MB
+
+#define VERIFY_BUFSIZE       (64 * 1024) // 64 KB
+#define EXTRACT_READ_BUFSIZE (64 * 1024) // 64 KB
+// Stored data in memory is checksummed and written this much at a time
+#define EXTRACT_STORED_CHUNK IO_BUFFER_SIZE
+// Writes straight from an aligned buffer skip the filesystem's bounce copy
+#define EXTRACT_BUFFER_ALIGNMENT 0x40
+
+int mkdir_p(const char *dir, const mode_t mode) {
+    char tmp[MAX_FILENAME];
+    char *p = NULL;
+    struct stat sb;
+    size_t len;
+
+    /* copy path */
+    len = strnlen(dir, MAX_FILENAME);
+    if (len == 0 || len == MAX_FILENAME) {
+        return -1;
+    }
+    memcpy(tmp, dir, len);
+    tmp[len] = '\0';
+
+    /* remove trailing slash */
+    if (tmp[len - 1] == '/') {
+        tmp[len - 1] = '\0';
+    }
+
+    /* check if path exists and is a directory */
+    if (stat(tmp, &sb) == 0) {
+        if (S_ISDIR(sb.st_mode)) {
+            return 0;
+        }
+    }
+
+    /* recursive mkdir */
+    for (p = tmp + 1; *p; p++) {
+        if (*p == '/') {
+            *p = 0;
+            /* test path */
+            if (stat(tmp, &sb) != 0) {
+                /* path does not exist - create directory */
+                if (mkdir(tmp, mode) < 0 && errno != EEXIST) {
+                    return -1;
+                }
+            } else if (!S_ISDIR(sb.st_mode)) {
+                /* not a directory */
+                return -1;
+            }
+            *p = '/';
+        }
+    }
+    /* test path */
+    if (stat(tmp, &sb) != 0) {
+        /* path does not exist - create directory */
+        if (mkdir(tmp, mode) < 0 && errno != EEXIST) {
+            return -1;
+        }
+    } else if (!S_ISDIR(sb.st_mode)) {
+        /* not a directory */
+        return -1;
+    }
+    return 0;
+}
+
+int DirCache::create(const char *dir) {
+    std::string path(dir);
+    while (!path.empty() && path.back() == '/')
+        path.pop_back();
+
+    mutex.lock();
+    int res = createLocked(path);
+    mutex.unlock();
+    return res;
+}
+
+int DirCache::createLocked(const std::string &path) {
+    if (path.empty() || dirs.count(path))
+        return 0;
+
+    // Parents first, each of them only once
+    size_t last = path.rfind('/');
+    if (last != std::string::npos && last > 0 && createLocked(path.substr(0, last)) < 0)
+        return -1;
+
+    // Only stat() when mkdir() fails for something other than an existing
+    // directory, e.g. on a device root like "fs:"
+    if (mkdir(path.c_str(), 0777) < 0 && errno != EEXIST) {
+        struct stat sb;
+        if (stat(path.c_str(), &sb) != 0 || !S_ISDIR(sb.st_mode))
+            return -1;
+    }
+    dirs.insert(path);
+    return 0;
+}
+
+int DirCache::createParent(const char *path) {
+    const char *last = strrchr(path, '/');
+    if (!last || last == path)
+        return 0;
+    return create(std::string(path, last - path).c_str());
+}
+
+SkipFilter::SkipFilter(const char *const *patterns, int count) {
+    for (int i = 0; i < count; i++) {
+        SkipPattern pattern;
+        pattern.pattern = patterns[i];
+        if (strpbrk(patterns[i], "*?["))
+            pattern.kind = SKIP_GLOB;
+        else if (strchr(patterns[i], '/'))
+            pattern.kind = SKIP_PREFIX;
+        else
+            pattern.kind = SKIP_COMPONENT;
+        this->patterns.push_back(pattern);
+    }
+}
+
+bool SkipFilter::matches(const char *path) const {
+    const char *base = strrchr(path, '/');
+    // Directory entries end with a slash, their name is the part before it
+    if (base && base[1] == '\0') {
+        while (base > path && base[-1] != '/')
+            base--;
+    } else {
+        base = base ? base + 1 : path;
+    }
+
+    for (const SkipPattern &pattern : patterns) {
+        const char *p = pattern.pattern.c_str();
+        size_t len = pattern.pattern.size();
+        switch (pattern.kind) {
+            case SKIP_COMPONENT:
+                for (const char *c = path; c;) {
+                    if (strncmp(c, p, len) == 0 && (c[len] == '/' || c[len] == '\0'))
+                        return true;
+                    c = strchr(c, '/');
+                    if (c)
+                        c++;
+                }
+                break;
+            case SKIP_PREFIX:
+                if (strncmp(path, p, len) == 0)
+                    return true;
+                break;
+            case SKIP_GLOB:
+                if (fnmatch(p, path, 0) == 0 || fnmatch(p, base, 0) == 0)
+                    return true;
+                break;
+        }
+    }
+    return false;
+}
+
+// Whether the file at path already has an entry's contents. Only the size is
+// compared in EXTRACT_SIZE mode, EXTRACT_CRC32 also reads the whole file.
+static bool fileUpToDate(const char *path, uint64_t size, uint32_t crc, ExtractMode mode) {
+    struct stat sb;
+    if (mode == EXTRACT_ALL || stat(path, &sb) != 0 || !S_ISREG(sb.st_mode) || (uint64_t) sb.st_size != size)
+        return false;
+    if (mode == EXTRACT_SIZE)
+        return true;
+
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return false;
+    uint8_t *buffer = (uint8_t *) malloc(VERIFY_BUFSIZE);
+    if (!buffer) {
+        fclose(file);
+        return false;
+    }
+
+    uint32_t fileCrc32 = CRC32_INIT;
+    size_t n;
+    while ((n = fread(buffer, 1, VERIFY_BUFSIZE, file)) > 0)
+        fileCrc32 = crc32_update(fileCrc32, buffer, n);
+    bool upToDate = !ferror(file) && fileCrc32 == crc;
+
+    free(buffer);
+    fclose(file);
+    return upToDate;
+}
+
+typedef struct ExtractEntry {
+    mz_uint index;
+    mz_uint64 size;
+    mz_uint64 compSize;
+    mz_uint64 offset;
+} ExtractEntry;
+
+typedef struct ExtractJob {
+    const char *zipfile;
+    // The whole archive, if it was small enough to preload
+    const uint8_t *data;
+    size_t dataSize;
+    ExtractMode mode;
+    InflateConfig inflate;
+    // Entries which are pipelined, extracted before the workers start
+    std::vector<ExtractEntry> big;
+    std::vector<ExtractEntry> entries;
+    std::atomic<bool> failed;
+} ExtractJob;
+
+// A worker's share of the entries, a run of them in archive order
+typedef struct ExtractRange {
+    ExtractJob *job;
+    size_t first;
+    size_t last;
+} ExtractRange;
+
+// Everything a worker needs to extract entries, allocated once and reused
+// for every entry instead of per call like mz_zip_reader_extract_to_file()
+typedef struct ExtractContext {
+    Arena arena;
+    ZipReader reader;
+    // Read and write stages for entries which are pipelined
+    AsyncReader readStage;
+    AsyncWriter writeStage;
+    StreamInflater inflater;
+    uint8_t *outBuffer;
+    uint8_t *readBuffer;
+    // More output windows for pipelined entries, which hand full ones to the
+    // write stage instead of having them copied. NULL elsewhere.
+    uint8_t *spareWindows[EXTRACT_PIPELINE_WINDOWS - 1];
+} ExtractContext;
+
+static bool initContext(ExtractContext *ctx, const ExtractJob *job, bool pipelined) {
+    // The window is read back by every match, the read buffer only once
+    ctx->outBuffer = (uint8_t *) memory_alloc(MEMORY_MEM1, EXTRACT_OUT_BUFSIZE, EXTRACT_BUFFER_ALIGNMENT);
+    ctx->readBuffer = (uint8_t *) memory_alloc(MEMORY_MEM2, EXTRACT_READ_BUFSIZE, EXTRACT_BUFFER_ALIGNMENT);
+    // Without them, the write stage copies the one window instead
+    for (int i = 0; i < EXTRACT_PIPELINE_WINDOWS - 1; i++) {
+        ctx->spareWindows[i] = pipelined ? (uint8_t *) memory_alloc(MEMORY_MEM1, EXTRACT_OUT_BUFSIZE, EXTRACT_BUFFER_ALIGNMENT)
+                                         : NULL;
+    }
+    return ctx->outBuffer && ctx->readBuffer && ctx->inflater.init(job->inflate.backend);
+}
+
+static void freeContext(ExtractContext *ctx) {
+    memory_free(ctx->outBuffer);
+    memory_free(ctx->readBuffer);
+    for (int i = 0; i < EXTRACT_PIPELINE_WINDOWS - 1; i++)
+        memory_free(ctx->spareWindows[i]);
+}
+
+// Every worker opens the archive on its own, either on the shared preloaded
+// copy or through its own read-ahead reader
+static bool openArchive(ExtractContext *ctx, mz_zip_archive *zip, const ExtractJob *job) {
+    memset(zip, 0, sizeof(*zip));
+    ctx->arena.install(zip);
+    if (job->data)
+        return mz_zip_reader_init_mem(zip, job->data, job->dataSize, 0);
+
+    if (!ctx->reader.open(job->zipfile))
+        return false;
+    ctx->reader.install(zip);
+    if (!mz_zip_reader_init(zip, ctx->reader.size(), 0)) {
+        ctx->reader.close();
+        return false;
+    }
+    return true;
+}
+
+static void closeArchive(ExtractContext *ctx, mz_zip_archive *zip) {
+    mz_zip_reader_end(zip);
+    ctx->reader.close();
+    ctx->arena.reset();
+}
+
+// Copies the entry's name out of the central directory, where it isn't
+// terminated. False if it's too long for a path.
+static bool entryFilename(const mz_zip_archive_file_view *entry, char *filename) {
+    if (entry->m_filename_len >= MAX_FILENAME) {
+        WHBLogPrintf("Filename too long: %.*s\n", (int) entry->m_filename_len, entry->m_pFilename);
+        return false;
+    }
+    memcpy(filename, entry->m_pFilename, entry->m_filename_len);
+    filename[entry->m_filename_len] = '\0';
+    return true;
+}
+
+// Where an entry's data comes from, in chunks of up to bufferSize: straight
+// out of a preloaded archive, read into buffer on this thread, or handed
+// over by a read stage
+typedef struct EntryInput {
+    mz_zip_archive *zip;
+    const uint8_t *memory;
+    uint8_t *buffer;
+    size_t bufferSize;
+    mz_uint64 offset;
+    mz_uint64 remaining;
+    AsyncReader *stage;
+} EntryInput;
+
+static const uint8_t *readInput(EntryInput *in, size_t *size) {
+    if (!in->remaining)
+        return NULL;
+    if (in->stage) {
+        const uint8_t *data = in->stage->next(size);
+        if (data)
+            in->remaining -= *size;
+        return data;
+    }
+
+    size_t n = (in->remaining < in->bufferSize) ? (size_t) in->remaining : in->bufferSize;
+    const uint8_t *data = in->memory + in->offset;
+    if (!in->memory) {
+        if (in->zip->m_pRead(in->zip->m_pIO_opaque, in->offset, in->buffer, n) != n)
+            return NULL;
+        data = in->buffer;
+    }
+    in->offset += n;
+    in->remaining -= n;
+    *size = n;
+    return data;
+}
+
+// Where the data goes: written on this thread, or queued for a write stage
+typedef struct EntryOutput {
+    FileWriter *file;
+    AsyncWriter *stage;
+} EntryOutput;
+
+static bool writeOutput(EntryOutput *out, const void *data, size_t size) {
+    return out->stage ? out->stage->write(data, size) : out->file->write(data, size);
+}
+
+typedef struct ParallelOutput {
+    EntryOutput *out;
+    uint32_t crc;
+    mz_uint64 written;
+} ParallelOutput;
+
+static bool parallelSink(void *arg, const uint8_t *data, size_t size) {
+    ParallelOutput *output = (ParallelOutput *) arg;
+    output->crc = crc32_update(output->crc, data, size);
+    output->written += size;
+    return writeOutput(output->out, data, size);
+}
+
+// Inflates a big entry with parallel_inflate(), straight from a preloaded
+// archive or from a copy of its compressed data. -1 if there wasn't memory
+// for the copy or it failed before writing anything, so the entry should be
+// inflated the usual way.
+static int inflateParallel(mz_zip_archive *zip, const ExtractJob *job, const mz_zip_archive_file_view *entry, mz_uint64 offset,
+                           EntryOutput *out) {
+    const uint8_t *src = NULL;
+    uint8_t *copy = NULL;
+    if (job->data) {
+        src = job->data + offset;
+    } else {
+        if (entry->m_comp_size > EXTRACT_PARALLEL_MAX ||
+            !(copy = (uint8_t *) memory_alloc(MEMORY_MEM2, entry->m_comp_size, EXTRACT_BUFFER_ALIGNMENT)))
+            return -1;
+        if (zip->m_pRead(zip->m_pIO_opaque, offset, copy, entry->m_comp_size) != entry->m_comp_size) {
+            memory_free(copy);
+            return 0;
+        }
+        src = copy;
+    }
+
+    ParallelOutput output = {out, CRC32_INIT, 0};
+    bool ok = parallel_inflate(src, entry->m_comp_size, parallelSink, &output);
+    memory_free(copy);
+    // Nothing reached out yet, so the serial inflate can start over
+    if (!ok && output.written == 0)
+        return -1;
+    return ok && output.written == entry->m_uncomp_size && output.crc == entry->m_crc32;
+}
+
+// Inflates or copies one entry into out. Inflated data is written once the
+// output buffer is full or the entry ends, so most files take a single write.
+// With a read stage, the next chunk is read while this one is inflated.
+// parallel tries parallel_inflate() first.
+static bool extractData(ExtractContext *ctx, mz_zip_archive *zip, const ExtractJob *job, const mz_zip_archive_file_view *entry,
+                        EntryOutput *out, AsyncReader *readStage, int readCore, bool parallel) {
+    uint8_t local[30];
+    if (zip->m_pRead(zip->m_pIO_opaque, entry->m_local_header_ofs, local, sizeof(local)) != sizeof(local) ||
+        MZ_READ_LE32(local) != ZIP_LOCAL_HEADER_SIG)
+        return false;
+
+    EntryInput in = {zip, job->data, ctx->readBuffer, EXTRACT_READ_BUFSIZE, 0, entry->m_comp_size, NULL};
+    in.offset = entry->m_local_header_ofs + sizeof(local) + MZ_READ_LE16(local + 26) + MZ_READ_LE16(local + 28);
+    if (job->data && in.offset + entry->m_comp_size > job->dataSize)
+        return false;
+    // Some zippers store empty files as deflated without any data, which
+    // miniz accepted and tinfl can't make progress on
+    if (entry->m_comp_size == 0 && entry->m_uncomp_size == 0)
+        return true;
+    // Stored data is written from wherever it was read to: the archive in
+    // memory, or the aligned output buffer, which is big enough for reads to
+    // pass the reader's window by. Its CRC is taken while it's in cache.
+    if (entry->m_method == 0) {
+        in.buffer = ctx->outBuffer;
+        in.bufferSize = job->data ? EXTRACT_STORED_CHUNK : EXTRACT_OUT_BUFSIZE;
+    }
+    if (parallel) {
+        int res = inflateParallel(zip, job, entry, in.offset, out);
+        if (res >= 0)
+            return res;
+    }
+    // Nothing else may read the archive until the stage is finished
+    if (readStage && readStage->start(zip, in.offset, in.remaining, readCore))
+        in.stage = readStage;
+
+    mz_uint64 written = 0;
+    uint32_t crc = CRC32_INIT;
+    bool ok = true;
+
+    if (entry->m_method == 0) {
+        while (in.remaining) {
+            size_t n;
+            const uint8_t *data = readInput(&in, &n);
+            if (!data) {
+                ok = false;
+                break;
+            }
+            crc = crc32_update(crc, data, n);
+            if (!writeOutput(out, data, n)) {
+                ok = false;
+                break;
+            }
+            written += n;
+        }
+    } else {
+        ctx->inflater.reset();
+        size_t outOffset = 0;
+        const uint8_t *inData = NULL;
+        size_t inAvail = 0;
+        // Files which fit are inflated in one go, without wrapping around
+        bool whole = entry->m_uncomp_size <= EXTRACT_OUT_BUFSIZE;
+        // With a write stage and spare windows, each full window is handed
+        // over as it is and inflating goes on in the next one
+        uint8_t *windows[EXTRACT_PIPELINE_WINDOWS] = {ctx->outBuffer};
+        uint32_t tickets[EXTRACT_PIPELINE_WINDOWS] = {};
+        bool handoff = out->stage != NULL;
+        for (int i = 1; i < EXTRACT_PIPELINE_WINDOWS; i++) {
+            windows[i] = ctx->spareWindows[i - 1];
+            handoff = handoff && windows[i];
+        }
+        int current = 0;
+        for (;;) {
+            if (!inAvail && in.remaining) {
+                inData = readInput(&in, &inAvail);
+                if (!inData) {
+                    ok = false;
+                    break;
+                }
+            }
+
+            size_t inSize = inAvail;
+            size_t outSize = EXTRACT_OUT_BUFSIZE - outOffset;
+            mz_uint32 flags = TINFL_FLAG_COMPUTE_CRC32;
+            if (in.remaining)
+                flags |= TINFL_FLAG_HAS_MORE_INPUT;
+            if (whole)
+                flags |= TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF;
+            uint8_t *window = windows[current];
+            tinfl_status status = ctx->inflater.run(inData, &inSize, window, window + outOffset, &outSize, flags);
+            inData += inSize;
+            inAvail -= inSize;
+            outOffset += outSize;
+            written += outSize;
+
+            if (outOffset == EXTRACT_OUT_BUFSIZE || status == TINFL_STATUS_DONE) {
+                // Past the buffer's end the data is bigger than the entry claims
+                if (whole && status != TINFL_STATUS_DONE) {
+                    ok = false;
+                    break;
+                }
+                if (handoff && outOffset) {
+                    if (!(tickets[current] = out->stage->queue(window, outOffset))) {
+                        ok = false;
+                        break;
+                    }
+                    if (status != TINFL_STATUS_DONE) {
+                        // The next window is free once the stage wrote what it
+                        // held last time. Matches reach back across the switch
+                        // into its end, where tinfl wraps to, so the last 32 KB
+                        // of this one go there.
+                        int next = (current + 1) % EXTRACT_PIPELINE_WINDOWS;
+                        if (!out->stage->wait(tickets[next])) {
+                            ok = false;
+                            break;
+                        }
+                        memcpy(windows[next] + EXTRACT_OUT_BUFSIZE - TINFL_LZ_DICT_SIZE,
+                               window + EXTRACT_OUT_BUFSIZE - TINFL_LZ_DICT_SIZE, TINFL_LZ_DICT_SIZE);
+                        current = next;
+                    }
+                } else if (outOffset && !writeOutput(out, window, outOffset)) {
+                    ok = false;
+                    break;
+                }
+                outOffset = 0;
+            }
+
+            if (status == TINFL_STATUS_DONE) {
+                crc = ctx->inflater.crc32();
+                break;
+            }
+            if (status < TINFL_STATUS_DONE || (status == TINFL_STATUS_NEEDS_MORE_INPUT && !inAvail && !in.remaining)) {
+                ok = false;
+                break;
+            }
+        }
+    }
+
+    if (in.stage && !in.stage->finish())
+        ok = false;
+    return ok && written == entry->m_uncomp_size && crc == entry->m_crc32;
+}
+
+static bool extractEntry(ExtractContext *ctx, mz_zip_archive *zip, const ExtractJob *job, mz_uint index, bool pipelined) {
+    mz_zip_archive_file_view entry;
+    char filename[MAX_FILENAME];
+    if (!mz_zip_reader_file_view(zip, index, &entry) || !entryFilename(&entry, filename))
+        return false;
+    if (fileUpToDate(filename, entry.m_uncomp_size, entry.m_crc32, job->mode))
+        return true;
+    if (!entry.m_is_supported) {
+        WHBLogPrintf("Unsupported zip entry: %s\n", filename);
+        return false;
+    }
+
+    // Pipelined entries read and write on the other two cores while this one
+    // inflates. A preloaded archive has nothing to read ahead, and stored
+    // data is written from the read buffers without a write stage. Huge
+    // deflated entries take all three cores to inflate instead, which leaves
+    // none for the stages.
+    int core = Thread::currentCore();
+    bool parallel = pipelined && job->inflate.parallel && entry.m_method == MZ_DEFLATED &&
+                    entry.m_comp_size >= EXTRACT_PARALLEL_SIZE && (job->data || entry.m_comp_size <= EXTRACT_PARALLEL_MAX);
+    pipelined = pipelined && !parallel;
+    FileWriter file;
+    EntryOutput out = {&file, NULL};
+    if (pipelined && entry.m_method != 0 && ctx->writeStage.open(filename, core + 2, entry.m_uncomp_size))
+        out.stage = &ctx->writeStage;
+    else if (!file.open(filename, entry.m_uncomp_size)) {
+        WHBLogPrintf("Error creating file: %s (%d)\n", filename, errno);
+        return false;
+    }
+    AsyncReader *readStage = (pipelined && !job->data) ? &ctx->readStage : NULL;
+    bool ok = extractData(ctx, zip, job, &entry, &out, readStage, core + 1, parallel);
+    if (!(out.stage ? out.stage->close() : file.close()))
+        ok = false;
+    if (!ok) {
+        WHBLogPrintf("Error extracting %s\n", filename);
+        return false;
+    }
+
+#ifndef MINIZ_NO_TIME
+    time_t mtime = mz_zip_reader_view_time(&entry);
+    struct utimbuf times = {mtime, mtime};
+    utime(filename, &times);
+#endif
+    return true;
+}
+
+// Opens the archive for this thread, so reads never contend for a shared
+// FILE, and extracts entries first to last - 1 of list. Each one's data
+// follows the one before it in the file, so the reader's read-ahead window
+// carries over from entry to entry.
+static void extractEntries(ExtractJob *job, const std::vector<ExtractEntry> &list, size_t first, size_t last,
+                           bool pipelined) {
+    ExtractContext ctx;
+    mz_zip_archive zip;
+    if (!initContext(&ctx, job, pipelined) || !openArchive(&ctx, &zip, job)) {
+        freeContext(&ctx);
+        job->failed = true;
+        return;
+    }
+
+    for (size_t i = first; i < last && !job->failed; i++) {
+        if (!extractEntry(&ctx, &zip, job, list[i].index, pipelined))
+            job->failed = true;
+    }
+    closeArchive(&ctx, &zip);
+    freeContext(&ctx);
+}
+
+static void extractWorker(void *arg) {
+    ExtractRange *range = (ExtractRange *) arg;
+    extractEntries(range->job, range->job->entries, range->first, range->last, false);
+}
+
+// Splits the entries into one run per worker, each about as much work
+static void splitEntries(ExtractJob *job, ExtractRange *ranges, int count) {
+    uint64_t total = 0;
+    for (const ExtractEntry &entry : job->entries)
+        total += entry.size + EXTRACT_FILE_COST;
+
+    size_t next = 0;
+    uint64_t done = 0;
+    for (int i = 0; i < count; i++) {
+        uint64_t target = total * (i + 1) / count;
+        ranges[i] = {job, next, next};
+        while (next < job->entries.size() && (done < target || i == count - 1)) {
+            done += job->entries[next].size + EXTRACT_FILE_COST;
+            next++;
+        }
+        ranges[i].last = next;
+    }
+}
+
+// Free space where the files go, in bytes, and the allocation unit
+static bool freeSpace(uint64_t *avail, uint64_t *block) {
+    char cwd[MAX_FILENAME];
+    struct statvfs st;
+    if (!getcwd(cwd, sizeof(cwd)) || statvfs(cwd, &st) != 0)
+        return false;
+    *block = st.f_frsize ? st.f_frsize : st.f_bsize;
+    *avail = (uint64_t) st.f_bavail * *block;
+    return true;
+}
+
+// Whether all the entries fit, checked once before anything is written.
+// Files which are replaced give their space back, but they're only looked
+// up when the sizes alone don't fit. If the free space can't be found out,
+// extraction just goes ahead.
+static bool checkFreeSpace(mz_zip_archive *zip, const ExtractJob *job) {
+    uint64_t avail, block;
+    if (!freeSpace(&avail, &block) || !block)
+        return true;
+
+    const std::vector<ExtractEntry> *lists[] = {&job->big, &job->entries};
+    uint64_t needed = 0;
+    for (const std::vector<ExtractEntry> *list : lists) {
+        for (const ExtractEntry &entry : *list)
+            needed += (entry.size + block - 1) / block * block;
+    }
+    if (needed <= avail)
+        return true;
+
+    for (const std::vector<ExtractEntry> *list : lists) {
+        for (const ExtractEntry &entry : *list) {
+            mz_zip_archive_file_view view;
+            char filename[MAX_FILENAME];
+            struct stat st;
+            if (mz_zip_reader_file_view(zip, entry.index, &view) && entryFilename(&view, filename) &&
+                stat(filename, &st) == 0 && S_ISREG(st.st_mode))
+                avail += ((uint64_t) st.st_size + block - 1) / block * block;
+        }
+    }
+    if (needed <= avail)
+        return true;
+    WHBLogPrintf("Not enough free space: %llu MB needed, %llu MB free\n", (unsigned long long) (needed >> 20),
+                 (unsigned long long) (avail >> 20));
+    return false;
+}
+
+// Archive order, so every run of entries is one forward sweep through the
+// file instead of jumping around with the central directory
+static bool compareEntryOffset(const ExtractEntry &a, const ExtractEntry &b) {
+    return a.offset < b.offset;
+}
+
+// Lists the archive, creates its directories and runs the workers on it.
+// data is the whole archive if it's in memory, or NULL to read zipfile.
+static int extractArchive(const char *zipfile, const uint8_t *data, size_t dataSize, const ExtractOptions *options) {
+    DirCache ownDirs;
+    DirCache *dirs = (options && options->dirs) ? options->dirs : &ownDirs;
+    const SkipFilter *skip = options ? options->skip : NULL;
+
+    ExtractJob job;
+    job.zipfile = zipfile;
+    job.mode = options ? options->mode : EXTRACT_ALL;
+    job.inflate = INFLATE_DEFAULT_CONFIG;
+    if (options)
+        job.inflate = options->inflate;
+    job.failed = false;
+    job.data = data;
+    job.dataSize = dataSize;
+
+    // The central directory is only listed here, it doesn't need the buffers
+    ExtractContext ctx = {};
+    mz_zip_archive zip;
+    if (!openArchive(&ctx, &zip, &job)) {
+        WHBLogPrintf("Error opening zip file: %s\n", zipfile);
+        return -1;
+    }
+    for (mz_uint i = 0; i < mz_zip_reader_get_num_files(&zip); i++) {
+        mz_zip_archive_file_view entry;
+        char filename[MAX_FILENAME];
+        if (!mz_zip_reader_file_view(&zip, i, &entry) || !entryFilename(&entry, filename)) {
+            WHBLogPrintf("Error reading zip file: %s\n", zipfile);
+            closeArchive(&ctx, &zip);
+            return -1;
+        }
+        if (skip && skip->matches(filename))
+            continue;
+
+        // Create the whole tree up front, so the workers only write files
+        int res = entry.m_is_directory ? dirs->create(filename) : dirs->createParent(filename);
+        if (res < 0) {
+            WHBLogPrintf("Error creating directory for: %s\n", filename);
+            closeArchive(&ctx, &zip);
+            return -1;
+        }
+        if (entry.m_is_directory)
+            continue;
+        ExtractEntry item = {i, entry.m_uncomp_size, entry.m_comp_size, entry.m_local_header_ofs};
+        (entry.m_comp_size >= EXTRACT_PIPELINE_SIZE ? job.big : job.entries).push_back(item);
+    }
+    if (!checkFreeSpace(&zip, &job)) {
+        closeArchive(&ctx, &zip);
+        return -1;
+    }
+    closeArchive(&ctx, &zip);
+
+    std::sort(job.big.begin(), job.big.end(), compareEntryOffset);
+    std::sort(job.entries.begin(), job.entries.end(), compareEntryOffset);
+
+    // Pipelined entries have all three cores to themselves: this thread
+    // inflates while their stages read and write on the other two
+    if (!job.big.empty())
+        extractEntries(&job, job.big, 0, job.big.size(), true);
+
+    // Then one worker runs on this thread, the others on the remaining cores,
+    // each on its own run of entries
+    ExtractRange ranges[EXTRACT_THREADS];
+    splitEntries(&job, ranges, EXTRACT_THREADS);
+    Thread workers[EXTRACT_THREADS - 1];
+    bool started[EXTRACT_THREADS] = {};
+    int core = Thread::currentCore();
+    for (int i = 1; i < EXTRACT_THREADS && !job.failed; i++) {
+        if (ranges[i].first < ranges[i].last)
+            started[i] = workers[i - 1].start(extractWorker, &ranges[i], core + i);
+    }
+    // This thread's run comes first, then any whose thread didn't start
+    for (int i = 0; i < EXTRACT_THREADS && !job.failed; i++) {
+        if (!started[i] && ranges[i].first < ranges[i].last)
+            extractWorker(&ranges[i]);
+    }
+    for (int i = 0; i < EXTRACT_THREADS - 1; i++)
+        workers[i].join();
+
+    if (job.failed) {
+        WHBLogPrintf("Error extracting zip file: %s\n", zipfile);
+        return -1;
+    }
+    return 0;
+}
+
+int extract_package(const char *zipfile, const ExtractOptions *options) {
+    // Extraction is almost all sequential reads, which the SD card is much
+    // better at in one piece than in the workers' interleaved chunks
+    size_t preloadLimit = options ? options->preloadLimit : EXTRACT_PRELOAD_LIMIT;
+    size_t dataSize = 0;
+    uint8_t *data = preloadLimit ? zip_load_file(zipfile, preloadLimit, &dataSize) : NULL;
+    int res = extractArchive(zipfile, data, dataSize, options);
+    memory_free(data);
+    return res;
+}
+
+int extract_package_mem(const uint8_t *data, size_t size, const char *name, const ExtractOptions *options) {
+    return extractArchive(name, data, size, options);
+}
+
+ZipStreamExtractor::ZipStreamExtractor(const ExtractOptions *options) : state(STREAM_HEADER), buffered(0), nameLength(0),
+                                                                        extraLength(0), bitFlags(0), method(0), expectedCrc32(0),
+                                                                        compSize(0), uncompSize(0), compConsumed(0), written(0),
+                                                                        entryCrc32(CRC32_INIT), skipping(false),
+                                                                        dictOffset(0) {
+    dirs = (options && options->dirs) ? options->dirs : &ownDirs;
+    skip = options ? options->skip : NULL;
+    mode = options ? options->mode : EXTRACT_ALL;
+    filename[0] = '\0';
+    InflateConfig inflate = INFLATE_DEFAULT_CONFIG;
+    if (options)
+        inflate = options->inflate;
+    dict = (uint8_t *) memory_alloc(MEMORY_MEM1, EXTRACT_OUT_BUFSIZE, EXTRACT_BUFFER_ALIGNMENT);
+    if (!inflater.init(inflate.backend) || !dict) {
+        WHBLogPrintf("Error allocating inflate state\n");
+        state = STREAM_ERROR;
+    }
+}
+
+ZipStreamExtractor::~ZipStreamExtractor() {
+    sink.finish();
+    closeFile();
+    memory_free(dict);
+}
+
+bool ZipStreamExtractor::startThread(int core) {
+    return state != STREAM_ERROR && sink.start(consume, this, core);
+}
+
+bool ZipStreamExtractor::checkSpace(uint64_t archiveSize) {
+    uint64_t avail, block;
+    if (!freeSpace(&avail, &block) || archiveSize <= avail)
+        return true;
+    WHBLogPrintf("Only %llu MB free for a %llu MB archive\n", (unsigned long long) (avail >> 20),
+                 (unsigned long long) (archiveSize >> 20));
+    state = STREAM_NO_SPACE;
+    return false;
+}
+
+bool ZipStreamExtractor::consume(void *arg, const uint8_t *data, size_t size) {
+    return ((ZipStreamExtractor *) arg)->process(data, size);
+}
+
+bool ZipStreamExtractor::write(const void *data, size_t size) {
+    if (sink.isRunning())
+        return sink.write(data, size);
+    return process((const uint8_t *) data, size);
+}
+
+size_t ZipStreamExtractor::fill(const uint8_t *data, size_t size, size_t needed) {
+    uint8_t *dest = (state == STREAM_DESCRIPTOR) ? descriptor : header;
+    size_t n = needed - buffered;
+    if (n > size)
+        n = size;
+    memcpy(dest + buffered, data, n);
+    buffered += n;
+    return n;
+}
+
+bool ZipStreamExtractor::process(const uint8_t *data, size_t size) {
+    const uint8_t *p = data;
+
+    while (size) {
+        size_t n = 0;
+        switch (state) {
+            case STREAM_HEADER:
+                n = fill(p, size, (buffered < 4) ? 4 : sizeof(header));
+                if (buffered == 4) {
+                    uint32_t sig = MZ_READ_LE32(header);
+                    if (sig == ZIP_CENTRAL_HEADER_SIG || sig == ZIP_END_HEADER_SIG || sig == ZIP64_END_HEADER_SIG) {
+                        // Everything after the last entry is metadata we don't need
+                        state = STREAM_DONE;
+                        return true;
+                    }
+                    if (sig != ZIP_LOCAL_HEADER_SIG) {
+                        WHBLogPrintf("Invalid zip header: %08x\n", sig);
+                        state = STREAM_ERROR;
+                        return false;
+                    }
+                } else if (buffered == sizeof(header)) {
+                    bitFlags = MZ_READ_LE16(header + 6);
+                    method = MZ_READ_LE16(header + 8);
+                    expectedCrc32 = MZ_READ_LE32(header + 14);
+                    compSize = MZ_READ_LE32(header + 18);
+                    uncompSize = MZ_READ_LE32(header + 22);
+                    nameLength = MZ_READ_LE16(header + 26);
+                    extraLength = MZ_READ_LE16(header + 28);
+                    if (nameLength == 0 || nameLength >= MAX_FILENAME) {
+                        WHBLogPrintf("Invalid zip entry name length: %u\n", nameLength);
+                        state = STREAM_ERROR;
+                        return false;
+                    }
+                    buffered = 0;
+                    state = STREAM_NAME;
+                }
+                break;
+            case STREAM_NAME:
+                n = nameLength + extraLength - buffered;
+                if (n > size)
+                    n = size;
+                if (buffered < nameLength)
+                    memcpy(filename + buffered, p, (n < nameLength - buffered) ? n : nameLength - buffered);
+                buffered += n;
+                if (buffered == nameLength + extraLength) {
+                    filename[nameLength] = '\0';
+                    if (!beginEntry())
+                        return false;
+                }
+                break;
+            case STREAM_DATA:
+                n = consumeData(p, size);
+                if (state == STREAM_ERROR)
+                    return false;
+                break;
+            case STREAM_DESCRIPTOR:
+                n = fill(p, size, (buffered < 12 || MZ_READ_LE32(descriptor) != ZIP_DESCRIPTOR_SIG) ? 12 : 16);
+                if (buffered == 12 && MZ_READ_LE32(descriptor) != ZIP_DESCRIPTOR_SIG) {
+                    if (!endEntry(MZ_READ_LE32(descriptor), MZ_READ_LE32(descriptor + 4), MZ_READ_LE32(descriptor + 8)))
+                        return false;
+                } else if (buffered == 16) {
+                    if (!endEntry(MZ_READ_LE32(descriptor + 4), MZ_READ_LE32(descriptor + 8), MZ_READ_LE32(descriptor + 12)))
+                        return false;
+                }
+                break;
+            case STREAM_DONE:
+                return true;
+            default:
+                return false;
+        }
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool ZipStreamExtractor::finish() {
+    sink.finish();
+    closeFile();
+    if (state == STREAM_DONE)
+        return true;
+    if (state != STREAM_ERROR && state != STREAM_UNSUPPORTED && state != STREAM_NO_SPACE) {
+        WHBLogPrintf("Zip stream ended unexpectedly\n");
+        state = STREAM_ERROR;
+    }
+    return false;
+}
+
+bool ZipStreamExtractor::beginEntry() {
+    if (bitFlags & (ZIP_FLAG_ENCRYPTED | ZIP_FLAG_STRONG_ENCRYPTED)) {
+        state = STREAM_UNSUPPORTED;
+        return false;
+    }
+    if (method != 0 && method != MZ_DEFLATED) {
+        state = STREAM_UNSUPPORTED;
+        return false;
+    }
+    if (bitFlags & ZIP_FLAG_DATA_DESCRIPTOR) {
+        // The end of a stored entry can't be found without knowing its size
+        if (method == 0) {
+            state = STREAM_UNSUPPORTED;
+            return false;
+        }
+    } else if (compSize == 0xFFFFFFFF || uncompSize == 0xFFFFFFFF) {
+        // ZIP64 sizes live in the extra field, which we don't parse
+        state = STREAM_UNSUPPORTED;
+        return false;
+    }
+
+    skipping = skip && skip->matches(filename);
+    // Unchanged files can only be recognized when the header has their size
+    if (!skipping && !(bitFlags & ZIP_FLAG_DATA_DESCRIPTOR) && filename[nameLength - 1] != '/')
+        skipping = fileUpToDate(filename, uncompSize, expectedCrc32, mode);
+    if (!skipping) {
+        if (filename[nameLength - 1] == '/') {
+            dirs->create(filename);
+        } else {
+            dirs->createParent(filename);
+            if (!file.open(filename, (bitFlags & ZIP_FLAG_DATA_DESCRIPTOR) ? 0 : uncompSize)) {
+                WHBLogPrintf("Error creating file: %s (%d)\n", filename, errno);
+                state = STREAM_ERROR;
+                return false;
+            }
+        }
+    }
+
+    inflater.reset();
+    dictOffset = 0;
+    entryCrc32 = CRC32_INIT;
+    written = 0;
+    compConsumed = 0;
+    buffered = 0;
+    state = STREAM_DATA;
+
+    if (!(bitFlags & ZIP_FLAG_DATA_DESCRIPTOR) && compSize == 0)
+        return endEntry(expectedCrc32, compSize, uncompSize);
+    return true;
+}
+
+bool ZipStreamExtractor::endEntry(uint32_t crc, uint64_t comp, uint64_t uncomp) {
+    if (!closeFile())
+        state = STREAM_ERROR;
+    if (state == STREAM_ERROR)
+        return false;
+    // Skipped entries are never inflated, so only their compressed size is known
+    if (comp != compConsumed || (!skipping && (uncomp != written || crc != entryCrc32))) {
+        WHBLogPrintf("Error extracting %s: CRC or size mismatch\n", filename);
+        state = STREAM_ERROR;
+        return false;
+    }
+    buffered = 0;
+    state = STREAM_HEADER;
+    return true;
+}
+
+size_t ZipStreamExtractor::consumeData(const uint8_t *data, size_t size) {
+    bool knownSize = !(bitFlags & ZIP_FLAG_DATA_DESCRIPTOR);
+    size_t avail = size;
+    if (knownSize && avail > compSize - compConsumed)
+        avail = (size_t) (compSize - compConsumed);
+
+    // Skipped entries of known size aren't inflated, the data is just passed over
+    if (method == 0 || (skipping && knownSize)) {
+        if (!output(data, avail)) {
+            state = STREAM_ERROR;
+            return 0;
+        }
+        if (!skipping)
+            entryCrc32 = crc32_update(entryCrc32, data, avail);
+        compConsumed += avail;
+        if (compConsumed == compSize)
+            endEntry(expectedCrc32, compSize, uncompSize);
+        return avail;
+    }
+
+    // Entries which are only inflated to find their end need no CRC
+    mz_uint32 flags = skipping ? 0 : TINFL_FLAG_COMPUTE_CRC32;
+    if (!knownSize || compConsumed + avail != compSize)
+        flags |= TINFL_FLAG_HAS_MORE_INPUT;
+
+    size_t consumed = 0;
+    for (;;) {
+        size_t inSize = avail - consumed;
+        size_t outSize = EXTRACT_OUT_BUFSIZE - dictOffset;
+        tinfl_status status = inflater.run(data + consumed, &inSize, dict, dict + dictOffset, &outSize, flags);
+        consumed += inSize;
+        dictOffset += outSize;
+        // Written out once the window is full or the entry ends
+        if (dictOffset == EXTRACT_OUT_BUFSIZE || status == TINFL_STATUS_DONE) {
+            if (dictOffset && !output(dict, dictOffset)) {
+                state = STREAM_ERROR;
+                return consumed;
+            }
+            dictOffset = 0;
+        }
+
+        if (status == TINFL_STATUS_HAS_MORE_OUTPUT)
+            continue;
+        compConsumed += consumed;
+        if (status == TINFL_STATUS_NEEDS_MORE_INPUT)
+            return consumed;
+        if (status != TINFL_STATUS_DONE) {
+            WHBLogPrintf("Error inflating %s: %d\n", filename, status);
+            state = STREAM_ERROR;
+            return consumed;
+        }
+
+        entryCrc32 = inflater.crc32();
+        if (knownSize) {
+            endEntry(expectedCrc32, compSize, uncompSize);
+        } else {
+            buffered = 0;
+            state = STREAM_DESCRIPTOR;
+        }
+        return consumed;
+    }
+}
+
+bool ZipStreamExtractor::output(const void *data, size_t size) {
+    if (skipping)
+        return true;
+    written += size;
+    if (file.isOpen() && !file.write(data, size)) {
+        WHBLogPrintf("Error writing file: %s\n", filename);
+        return false;
+    }
+    return true;
+}
+
+bool ZipStreamExtractor::closeFile() {
+    if (!file.isOpen())
+        return true;
+    if (!file.close()) {
+        WHBLogPrintf("Error writing file: %s\n", filename);
+        return false;
+    }
+    return true;
+}
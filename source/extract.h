@@ -0,0 +1,168 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "filewriter.h"
+#include "inflate.h"
+#include "miniz/miniz.h"
+#include "thread.h"
+
+#define MAX_FILENAME 256
+
+// Inflate output window, a power of two so tinfl can wrap around in it
+#define EXTRACT_OUT_BUFSIZE (1024 * 1024) // 1 MB
+// Archives up to this size are read into memory in one go by default
+#define EXTRACT_PRELOAD_LIMIT (32 * 1024 * 1024) // 32 MB
+
+int mkdir_p(const char *dir, const mode_t mode);
+
+// Directories which are known to exist, so extracting hundreds of files into
+// the same few folders only creates each of them once instead of walking
+// every path component with stat(). Shared by the stream extractors of
+// packages which are downloaded at the same time, so it takes a lock.
+class DirCache {
+public:
+    // Creates dir and its parents, like mkdir_p()
+    int create(const char *dir);
+    // Creates the directory a file path lives in
+    int createParent(const char *path);
+
+private:
+    int createLocked(const std::string &path);
+
+    Mutex mutex;
+    std::unordered_set<std::string> dirs;
+};
+
+// Archive entries which shouldn't be extracted. Patterns are sorted into
+// kinds once: plain names match any path component ("src", "info.json"),
+// names with a slash match a path prefix ("wiiu/apps/foo/"), and names with
+// *, ? or [ are globs matched against both the path and its basename.
+class SkipFilter {
+public:
+    SkipFilter(const char *const *patterns, int count);
+
+    bool matches(const char *path) const;
+
+private:
+    typedef enum SkipKind {
+        SKIP_COMPONENT,
+        SKIP_PREFIX,
+        SKIP_GLOB
+    } SkipKind;
+
+    typedef struct SkipPattern {
+        SkipKind kind;
+        std::string pattern;
+    } SkipPattern;
+
+    std::vector<SkipPattern> patterns;
+};
+
+typedef enum ExtractMode {
+    EXTRACT_ALL,   // Write every entry
+    EXTRACT_SIZE,  // Leave files on disk which have the entry's size
+    EXTRACT_CRC32  // Leave files on disk which have the entry's size and CRC-32
+} ExtractMode;
+
+typedef struct ExtractOptions {
+    // Directory cache shared across a run, or NULL for a private one
+    DirCache *dirs;
+    // Entries which aren't extracted, or NULL to extract everything
+    const SkipFilter *skip;
+    ExtractMode mode;
+    // Archives up to this size are extracted from memory, 0 always reads the file
+    size_t preloadLimit;
+    // Usually inflate_select()
+    InflateConfig inflate;
+} ExtractOptions;
+
+int extract_package(const char *zipfile, const ExtractOptions *options = NULL);
+// Same for an archive which is already in memory, name is only for messages
+int extract_package_mem(const uint8_t *data, size_t size, const char *name, const ExtractOptions *options = NULL);
+
+// Extracts a ZIP archive while it is being received, by walking the local
+// file headers in stream order. Archives which can't be walked that way
+// (stored entries with a trailing data descriptor, ZIP64, encryption) are
+// reported through unsupported() so the caller can fall back to
+// extract_package() on a downloaded copy. Entries matching the skip filter
+// are passed over without being inflated whenever their size is known, and
+// so are unchanged files in the incremental modes.
+class ZipStreamExtractor {
+public:
+    explicit ZipStreamExtractor(const ExtractOptions *options = NULL);
+    ~ZipStreamExtractor();
+
+    // Extracts on a thread of its own on core from now on, so inflating and
+    // writing to the SD card don't hold up whoever calls write(). write()
+    // then only queues the data, and fails once extracting did.
+    bool startThread(int core);
+    // Takes the archive's size before any of it is written. Its files need
+    // at least about that much, so if the card has less free space, the
+    // download is cancelled and reported through outOfSpace().
+    bool checkSpace(uint64_t archiveSize);
+    bool write(const void *data, size_t size);
+    // Waits for the thread, if any, to get through everything written
+    bool finish();
+    bool unsupported() const { return state == STREAM_UNSUPPORTED; }
+    bool outOfSpace() const { return state == STREAM_NO_SPACE; }
+
+private:
+    typedef enum StreamState {
+        STREAM_HEADER,
+        STREAM_NAME,
+        STREAM_DATA,
+        STREAM_DESCRIPTOR,
+        STREAM_DONE,
+        STREAM_UNSUPPORTED,
+        STREAM_NO_SPACE,
+        STREAM_ERROR
+    } StreamState;
+
+    static bool consume(void *arg, const uint8_t *data, size_t size);
+    bool process(const uint8_t *data, size_t size);
+    size_t fill(const uint8_t *data, size_t size, size_t needed);
+    bool beginEntry();
+    bool endEntry(uint32_t crc, uint64_t comp, uint64_t uncomp);
+    size_t consumeData(const uint8_t *data, size_t size);
+    bool output(const void *data, size_t size);
+    bool closeFile();
+
+    DirCache ownDirs;
+    DirCache *dirs;
+    const SkipFilter *skip;
+    ExtractMode mode;
+
+    StreamState state;
+    uint8_t header[30];
+    uint8_t descriptor[16];
+    size_t buffered;
+
+    char filename[MAX_FILENAME];
+    uint32_t nameLength;
+    uint32_t extraLength;
+
+    uint16_t bitFlags;
+    uint16_t method;
+    uint32_t expectedCrc32;
+    uint64_t compSize;
+    uint64_t uncompSize;
+
+    uint64_t compConsumed;
+    uint64_t written;
+    uint32_t entryCrc32;
+    bool skipping;
+    FileWriter file;
+
+    StreamInflater inflater;
+    uint8_t *dict;
+    size_t dictOffset;
+
+    AsyncSink sink;
+};
@@ -0,0 +1,324 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "filewriter.h"
+#include "memory.h"
+
+BufferPool ioBuffers;
+
+BufferPool::~BufferPool() {
+    for (uint8_t *buffer : buffers)
+        memory_free(buffer);
+}
+
+uint8_t *BufferPool::acquire() {
+    mutex.lock();
+    uint8_t *buffer = NULL;
+    if (!buffers.empty()) {
+        buffer = buffers.back();
+        buffers.pop_back();
+    }
+    mutex.unlock();
+
+    if (!buffer)
+        buffer = (uint8_t *) memory_alloc(MEMORY_MEM2, IO_BUFFER_SIZE, IO_BUFFER_ALIGNMENT);
+    return buffer;
+}
+
+void BufferPool::release(uint8_t *buffer) {
+    if (!buffer)
+        return;
+
+    mutex.lock();
+    if (buffers.size() < IO_POOL_MAX_FREE) {
+        buffers.push_back(buffer);
+        buffer = NULL;
+    }
+    mutex.unlock();
+    memory_free(buffer);
+}
+
+static bool writeAll(int fd, const uint8_t *data, size_t size) {
+    while (size) {
+        ssize_t n = ::write(fd, data, size);
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+// On FAT, growing a file write by write extends its cluster chain every time
+// and scatters it. Setting the final size first allocates it in one go.
+// Best effort: if the filesystem can't, the file just grows as it's written.
+static bool preallocate(int fd, uint64_t size) {
+#ifdef __linux__
+    if (posix_fallocate(fd, 0, size) == 0)
+        return true;
+#endif
+    return ftruncate(fd, size) == 0;
+}
+
+FileWriter::FileWriter() : fd(-1), buffer(NULL), used(0), failed(false), reserved(0), written(0) {}
+
+FileWriter::~FileWriter() {
+    close();
+}
+
+bool FileWriter::open(const char *path, uint64_t size) {
+    close();
+    failed = false;
+    used = 0;
+    reserved = 0;
+    written = 0;
+
+    fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+        return false;
+    buffer = ioBuffers.acquire();
+    if (!buffer) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    if (size > FILE_WRITER_PREALLOCATE_MIN) {
+        if (preallocate(fd, size))
+            reserved = size;
+        // The console's filesystem may leave the position at the new end
+        // of the file, and writing has to start at the beginning
+        if (lseek(fd, 0, SEEK_SET) != 0) {
+            close();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FileWriter::flush() {
+    if (used) {
+        if (writeAll(fd, buffer, used))
+            written += used;
+        else
+            failed = true;
+    }
+    used = 0;
+    return !failed;
+}
+
+bool FileWriter::write(const void *data, size_t size) {
+    const uint8_t *p = (const uint8_t *) data;
+    if (fd < 0 || failed)
+        return false;
+
+    while (size) {
+        // Aligned data skips the copy, in whole aligned blocks
+        if (!used && !((uintptr_t) p & (IO_BUFFER_ALIGNMENT - 1)) && size >= IO_BUFFER_SIZE) {
+            size_t n = size & ~(size_t) (IO_BUFFER_ALIGNMENT - 1);
+            if (!writeAll(fd, p, n)) {
+                failed = true;
+                return false;
+            }
+            written += n;
+            p += n;
+            size -= n;
+            continue;
+        }
+
+        size_t n = IO_BUFFER_SIZE - used;
+        if (n > size)
+            n = size;
+        memcpy(buffer + used, p, n);
+        used += n;
+        p += n;
+        size -= n;
+        if (used == IO_BUFFER_SIZE && !flush())
+            return false;
+    }
+    return true;
+}
+
+bool FileWriter::close() {
+    if (fd < 0)
+        return !failed;
+
+    flush();
+    // Whatever was reserved but not written would otherwise pass for data,
+    // e.g. to a size check deciding whether the file needs extracting again
+    if (reserved && reserved != written && ftruncate(fd, written) != 0)
+        failed = true;
+    if (::close(fd) != 0)
+        failed = true;
+    fd = -1;
+    ioBuffers.release(buffer);
+    buffer = NULL;
+    return !failed;
+}
+
+AsyncSink::AsyncSink() : consumer(NULL), arg(NULL), head(0), tail(0), done(false), failed(false), used(0),
+                         running(false) {
+    for (int i = 0; i < ASYNC_SINK_BUFFERS; i++)
+        buffers[i] = NULL;
+}
+
+AsyncSink::~AsyncSink() {
+    finish();
+}
+
+bool AsyncSink::start(SinkConsumer consumer, void *arg, int core) {
+    finish();
+    this->consumer = consumer;
+    this->arg = arg;
+    head = tail = 0;
+    done = failed = false;
+    used = 0;
+
+    if (!thread.start(run, this, core))
+        return false;
+    running = true;
+    return true;
+}
+
+void AsyncSink::run(void *arg) {
+    AsyncSink *sink = (AsyncSink *) arg;
+    for (;;) {
+        uint32_t tail = sink->tail.load(std::memory_order_relaxed);
+        if (tail == sink->head.load(std::memory_order_acquire)) {
+            // done is only set after the last slot was queued
+            if (sink->done.load(std::memory_order_acquire) && tail == sink->head.load(std::memory_order_acquire))
+                break;
+            sink->queued.wait();
+            continue;
+        }
+
+        uint32_t slot = tail % ASYNC_SINK_BUFFERS;
+        if (!sink->failed && !sink->consumer(sink->arg, sink->slots[slot], sink->sizes[slot]))
+            sink->failed = true;
+        sink->tail.store(tail + 1, std::memory_order_release);
+        sink->consumed.signal();
+    }
+}
+
+// Blocks while the slot at head is still queued from the last time around
+bool AsyncSink::waitSlot() {
+    uint32_t head = this->head.load(std::memory_order_relaxed);
+    while (head - tail.load(std::memory_order_acquire) == ASYNC_SINK_BUFFERS && !failed)
+        consumed.wait();
+    return !failed;
+}
+
+uint32_t AsyncSink::push(const uint8_t *data, size_t size) {
+    uint32_t head = this->head.load(std::memory_order_relaxed);
+    slots[head % ASYNC_SINK_BUFFERS] = data;
+    sizes[head % ASYNC_SINK_BUFFERS] = size;
+    this->head.store(head + 1, std::memory_order_release);
+    queued.signal();
+    return head + 1;
+}
+
+bool AsyncSink::write(const void *data, size_t size) {
+    const uint8_t *p = (const uint8_t *) data;
+    if (!running || failed)
+        return false;
+
+    while (size) {
+        uint32_t slot = head.load(std::memory_order_relaxed) % ASYNC_SINK_BUFFERS;
+        if (!used) {
+            if (!waitSlot())
+                return false;
+            if (!buffers[slot] && !(buffers[slot] = ioBuffers.acquire())) {
+                failed = true;
+                return false;
+            }
+        }
+
+        size_t n = IO_BUFFER_SIZE - used;
+        if (n > size)
+            n = size;
+        memcpy(buffers[slot] + used, p, n);
+        used += n;
+        p += n;
+        size -= n;
+        if (used == IO_BUFFER_SIZE) {
+            push(buffers[slot], used);
+            used = 0;
+        }
+    }
+    return !failed;
+}
+
+uint32_t AsyncSink::queue(const uint8_t *data, size_t size) {
+    if (!running || failed)
+        return 0;
+
+    // Whatever write() copied so far goes first
+    if (used) {
+        push(buffers[head.load(std::memory_order_relaxed) % ASYNC_SINK_BUFFERS], used);
+        used = 0;
+    }
+    if (!waitSlot())
+        return 0;
+    return push(data, size);
+}
+
+bool AsyncSink::wait(uint32_t ticket) {
+    while ((int32_t) (tail.load(std::memory_order_acquire) - ticket) < 0)
+        consumed.wait();
+    return !failed;
+}
+
+bool AsyncSink::finish() {
+    if (!running)
+        return !failed;
+
+    if (used)
+        push(buffers[head.load(std::memory_order_relaxed) % ASYNC_SINK_BUFFERS], used);
+    used = 0;
+    done.store(true, std::memory_order_release);
+    queued.signal();
+    thread.join();
+
+    for (int i = 0; i < ASYNC_SINK_BUFFERS; i++) {
+        ioBuffers.release(buffers[i]);
+        buffers[i] = NULL;
+    }
+    running = false;
+    return !failed;
+}
+
+bool AsyncWriter::consume(void *arg, const uint8_t *data, size_t size) {
+    return ((FileWriter *) arg)->write(data, size);
+}
+
+bool AsyncWriter::open(const char *path, int core, uint64_t size) {
+    close();
+    if (!file.open(path, size))
+        return false;
+    if (!sink.start(consume, &file, core)) {
+        file.close();
+        return false;
+    }
+    return true;
+}
+
+bool AsyncWriter::write(const void *data, size_t size) {
+    return sink.write(data, size);
+}
+
+uint32_t AsyncWriter::queue(const uint8_t *data, size_t size) {
+    return sink.queue(data, size);
+}
+
+bool AsyncWriter::wait(uint32_t ticket) {
+    return sink.wait(ticket);
+}
+
+bool AsyncWriter::close() {
+    if (!sink.isRunning())
+        return true;
+
+    bool ok = sink.finish();
+    return file.close() && ok;
+}
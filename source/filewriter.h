@@ -0,0 +1,132 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <vector>
+
+#include "thread.h"
+
+// The console's filesystem only DMAs straight from 0x40-aligned memory,
+// anything else is copied through a bounce buffer first
+#define IO_BUFFER_ALIGNMENT 0x40
+#define IO_BUFFER_SIZE      (128 * 1024) // 128 KB
+#define IO_POOL_MAX_FREE    8
+
+#define ASYNC_SINK_BUFFERS 4
+
+// Aligned IO_BUFFER_SIZE buffers, kept around for reuse once released
+class BufferPool {
+public:
+    ~BufferPool();
+
+    uint8_t *acquire();
+    void release(uint8_t *buffer);
+
+private:
+    Mutex mutex;
+    std::vector<uint8_t *> buffers;
+};
+
+extern BufferPool ioBuffers;
+
+// Files bigger than a single write get their final size reserved up front
+#define FILE_WRITER_PREALLOCATE_MIN IO_BUFFER_SIZE
+
+// Writes a file through plain POSIX calls, in whole aligned buffers from
+// ioBuffers. Data which is already aligned goes to the filesystem directly.
+class FileWriter {
+public:
+    FileWriter();
+    ~FileWriter();
+
+    // size is what the file is expected to end up at, 0 if unknown
+    bool open(const char *path, uint64_t size = 0);
+    bool write(const void *data, size_t size);
+    // Flushes and closes the file, false if anything failed along the way
+    bool close();
+    bool isOpen() const { return fd >= 0; }
+
+private:
+    bool flush();
+
+    int fd;
+    uint8_t *buffer;
+    size_t used;
+    bool failed;
+    // Bytes reserved by open() and actually written
+    uint64_t reserved;
+    uint64_t written;
+};
+
+// Receives what an AsyncSink hands over, on the sink's thread. Returning
+// false fails the sink, everything queued after that is dropped.
+typedef bool (*SinkConsumer)(void *arg, const uint8_t *data, size_t size);
+
+// Hands data to a consumer on its own thread, so a slow consumer doesn't
+// stall whoever produces the data. write() copies into one of
+// ASYNC_SINK_BUFFERS pooled buffers and hands full ones to the thread
+// through a single-producer single-consumer ring, queue() hands over the
+// caller's buffer as it is. The producer only blocks when every slot is
+// still queued, and the thread when none is, both on an Event rather than
+// by polling.
+class AsyncSink {
+public:
+    AsyncSink();
+    ~AsyncSink();
+
+    bool start(SinkConsumer consumer, void *arg, int core);
+    bool write(const void *data, size_t size);
+    // Queues data without copying it. It has to stay untouched until wait()
+    // returns for the ticket this hands out, which is 0 if the sink failed.
+    uint32_t queue(const uint8_t *data, size_t size);
+    // Blocks until the data queued with ticket was consumed, false if the
+    // consumer failed
+    bool wait(uint32_t ticket);
+    // Hands over what's left and stops the thread, false if the consumer failed
+    bool finish();
+    bool isRunning() const { return running; }
+
+private:
+    static void run(void *arg);
+    bool waitSlot();
+    uint32_t push(const uint8_t *data, size_t size);
+
+    SinkConsumer consumer;
+    void *arg;
+    Thread thread;
+    Event queued;
+    Event consumed;
+    // Copy buffers, one per slot, acquired the first time write() fills it
+    uint8_t *buffers[ASYNC_SINK_BUFFERS];
+    const uint8_t *slots[ASYNC_SINK_BUFFERS];
+    size_t sizes[ASYNC_SINK_BUFFERS];
+    // Slots head - 1 down to tail are queued, the producer fills head
+    std::atomic<uint32_t> head;
+    std::atomic<uint32_t> tail;
+    std::atomic<bool> done;
+    std::atomic<bool> failed;
+    size_t used;
+    bool running;
+};
+
+// FileWriter behind an AsyncSink, so a slow SD card doesn't stall whoever
+// produces the data
+class AsyncWriter {
+public:
+    bool open(const char *path, int core, uint64_t size = 0);
+    bool write(const void *data, size_t size);
+    // Like AsyncSink::queue() and wait(), for whole aligned buffers which
+    // then go to the filesystem without any copy
+    uint32_t queue(const uint8_t *data, size_t size);
+    bool wait(uint32_t ticket);
+    // Writes what's left, stops the thread and closes the file
+    bool close();
+
+private:
+    static bool consume(void *arg, const uint8_t *data, size_t size);
+
+    FileWriter file;
+    AsyncSink sink;
+};
@@ -0,0 +1,291 @@
+#include <whb/log.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "crc32.h"
+#include "extract.h"
+#include "inflate.h"
+#include "memory.h"
+#include "pinflate.h"
+#include "thread.h"
+
+// Same shape as extraction: 1 MB wrapping output, 64 KB of input per call
+#define INFLATE_BENCH_WINDOW (1024 * 1024) // 1 MB
+#define INFLATE_BENCH_INPUT  (64 * 1024)   // 64 KB
+// Alternating text and code, so both literal runs and matches count
+#define INFLATE_BENCH_SEGMENT (16 * 1024) // 16 KB
+
+#define INFLATE_BENCH_FAILED UINT64_MAX
+
+StreamInflater::StreamInflater() : backend(INFLATE_TINFL), tinfl(NULL), zlib(NULL), crc(CRC32_INIT) {}
+
+StreamInflater::~StreamInflater() {
+    if (zlib)
+        inflateEnd(zlib);
+    memory_free(zlib);
+    memory_free(tinfl);
+}
+
+// zlib's state and window are as hot as tinfl's
+static voidpf zlibAlloc(voidpf opaque, uInt items, uInt size) {
+    return memory_alloc(MEMORY_MEM1, (size_t) items * size);
+}
+
+static void zlibFree(voidpf opaque, voidpf address) {
+    memory_free(address);
+}
+
+bool StreamInflater::init(InflateBackend backend) {
+    this->backend = backend;
+    if (backend == INFLATE_ZLIB) {
+        if (zlib)
+            return true;
+        zlib = (z_stream *) memory_alloc(MEMORY_MEM1, sizeof(z_stream));
+        if (!zlib)
+            return false;
+        memset(zlib, 0, sizeof(z_stream));
+        zlib->zalloc = zlibAlloc;
+        zlib->zfree = zlibFree;
+        // Negative window bits: raw deflate, no zlib header or Adler-32
+        if (inflateInit2(zlib, -MAX_WBITS) != Z_OK) {
+            memory_free(zlib);
+            zlib = NULL;
+            return false;
+        }
+        return true;
+    }
+
+    if (!tinfl)
+        tinfl = (tinfl_decompressor *) memory_alloc(MEMORY_MEM1, sizeof(tinfl_decompressor));
+    return tinfl != NULL;
+}
+
+void StreamInflater::reset() {
+    crc = CRC32_INIT;
+    if (backend == INFLATE_ZLIB)
+        inflateReset(zlib);
+    else
+        tinfl_init(tinfl);
+}
+
+tinfl_status StreamInflater::run(const uint8_t *in, size_t *inSize, uint8_t *outStart, uint8_t *outNext, size_t *outSize,
+                                 mz_uint32 flags) {
+    if (backend == INFLATE_TINFL)
+        return tinfl_decompress(tinfl, in, inSize, outStart, outNext, outSize, flags);
+
+    // zlib keeps its own window, so output never has to wrap
+    zlib->next_in = (Bytef *) in;
+    zlib->avail_in = *inSize;
+    zlib->next_out = outNext;
+    zlib->avail_out = *outSize;
+    int res = inflate(zlib, Z_NO_FLUSH);
+    *inSize -= zlib->avail_in;
+    *outSize -= zlib->avail_out;
+    if (flags & TINFL_FLAG_COMPUTE_CRC32)
+        crc = crc32_update(crc, outNext, *outSize);
+
+    if (res == Z_STREAM_END)
+        return TINFL_STATUS_DONE;
+    if (res != Z_OK && res != Z_BUF_ERROR)
+        return TINFL_STATUS_FAILED;
+    if (!zlib->avail_out)
+        return TINFL_STATUS_HAS_MORE_OUTPUT;
+    return (flags & TINFL_FLAG_HAS_MORE_INPUT) ? TINFL_STATUS_NEEDS_MORE_INPUT : TINFL_STATUS_FAILED_CANNOT_MAKE_PROGRESS;
+}
+
+uint32_t StreamInflater::crc32() const {
+    return (backend == INFLATE_ZLIB) ? crc : tinfl_get_crc32(tinfl);
+}
+
+const char *inflate_backend_name(InflateBackend backend) {
+    return (backend == INFLATE_ZLIB) ? "zlib" : "tinfl";
+}
+
+#ifndef INFLATE_BACKEND
+// Deterministic stand-in for package contents: English-ish text and big
+// endian instruction words from a handful of opcodes
+static void fillSample(uint8_t *data, size_t size) {
+    static const char *const words[] = {"the ", "homebrew ", "plugin ", "module ", "environment ", "setup ",
+                                        "return ", "config", " = ", "0x", "{\n", "}\n", "    ", "aroma ",
+                                        "payload ", "\n"};
+    static const uint8_t opcodes[] = {0x38, 0x3c, 0x48, 0x4e, 0x7c, 0x80, 0x90, 0x94};
+    uint32_t x = 0x2545F491;
+    size_t i = 0;
+    while (i < size) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        if ((i / INFLATE_BENCH_SEGMENT) & 1) {
+            const char *word = words[x % (sizeof(words) / sizeof(words[0]))];
+            for (; *word && i < size; word++)
+                data[i++] = *word;
+        } else {
+            uint8_t insn[4] = {opcodes[x & 7], (uint8_t) ((x >> 3) & 0x3f), 0, (uint8_t) ((x >> 9) & 0x7c)};
+            for (int k = 0; k < 4 && i < size; k++)
+                data[i++] = insn[k];
+        }
+    }
+}
+
+// Raw deflate of the sample, at zlib's fastest level to keep startup short
+static uint8_t *compressSample(const uint8_t *data, size_t size, size_t *compSize) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, Z_BEST_SPEED, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return NULL;
+
+    uLong bound = deflateBound(&stream, size);
+    uint8_t *comp = (uint8_t *) memory_alloc(MEMORY_MEM2, bound);
+    if (comp) {
+        stream.next_in = (Bytef *) data;
+        stream.avail_in = size;
+        stream.next_out = comp;
+        stream.avail_out = bound;
+        if (deflate(&stream, Z_FINISH) == Z_STREAM_END) {
+            *compSize = stream.total_out;
+        } else {
+            memory_free(comp);
+            comp = NULL;
+        }
+    }
+    deflateEnd(&stream);
+    return comp;
+}
+
+static uint64_t timeStream(InflateBackend backend, const uint8_t *src, size_t size, uint8_t *window) {
+    StreamInflater inflater;
+    if (!inflater.init(backend))
+        return INFLATE_BENCH_FAILED;
+    inflater.reset();
+
+    uint64_t start = Thread::timeUs();
+    size_t inPos = 0, outOffset = 0, total = 0;
+    for (;;) {
+        size_t inSize = (size - inPos < INFLATE_BENCH_INPUT) ? size - inPos : INFLATE_BENCH_INPUT;
+        size_t outSize = INFLATE_BENCH_WINDOW - outOffset;
+        mz_uint32 flags = (inPos + inSize < size) ? TINFL_FLAG_HAS_MORE_INPUT : 0;
+        tinfl_status status = inflater.run(src + inPos, &inSize, window, window + outOffset, &outSize, flags);
+        inPos += inSize;
+        outOffset = (outOffset + outSize) & (INFLATE_BENCH_WINDOW - 1);
+        total += outSize;
+        if (status == TINFL_STATUS_DONE)
+            break;
+        if (status < TINFL_STATUS_DONE)
+            return INFLATE_BENCH_FAILED;
+    }
+    uint64_t elapsed = Thread::timeUs() - start;
+    return (total == INFLATE_BENCH_SIZE) ? elapsed : INFLATE_BENCH_FAILED;
+}
+
+static bool countSink(void *arg, const uint8_t *data, size_t size) {
+    *(size_t *) arg += size;
+    return true;
+}
+
+static uint64_t timeParallel(const uint8_t *src, size_t size) {
+    size_t total = 0;
+    uint64_t start = Thread::timeUs();
+    bool ok = parallel_inflate(src, size, countSink, &total);
+    uint64_t elapsed = Thread::timeUs() - start;
+    return (ok && total == INFLATE_BENCH_SIZE) ? elapsed : INFLATE_BENCH_FAILED;
+}
+
+// False if it couldn't be measured, config is then the default
+static bool benchmark(InflateConfig *config) {
+    *config = INFLATE_DEFAULT_CONFIG;
+    // Where extraction keeps them: the window in MEM1, the data in MEM2
+    uint8_t *data = (uint8_t *) memory_alloc(MEMORY_MEM2, INFLATE_BENCH_SIZE);
+    uint8_t *window = (uint8_t *) memory_alloc(MEMORY_MEM1, INFLATE_BENCH_WINDOW);
+    uint8_t *comp = NULL;
+    size_t compSize = 0;
+    if (data && window) {
+        fillSample(data, INFLATE_BENCH_SIZE);
+        comp = compressSample(data, INFLATE_BENCH_SIZE, &compSize);
+    }
+    memory_free(data);
+    if (!comp) {
+        memory_free(window);
+        WHBLogPrintf("Inflate benchmark failed, using %s\n", inflate_backend_name(config->backend));
+        return false;
+    }
+
+    uint64_t tinflTime = timeStream(INFLATE_TINFL, comp, compSize, window);
+    uint64_t zlibTime = timeStream(INFLATE_ZLIB, comp, compSize, window);
+    uint64_t parallelTime = timeParallel(comp, compSize);
+    memory_free(comp);
+    memory_free(window);
+
+    if (tinflTime == INFLATE_BENCH_FAILED && zlibTime == INFLATE_BENCH_FAILED)
+        return false;
+    config->backend = (zlibTime < tinflTime) ? INFLATE_ZLIB : INFLATE_TINFL;
+    // parallel_inflate() only runs while the other cores are idle, as they
+    // are here, so the times compare like they do during extraction
+    uint64_t streamTime = (config->backend == INFLATE_ZLIB) ? zlibTime : tinflTime;
+    config->parallel = parallelTime < streamTime;
+    WHBLogPrintf("Inflate: tinfl %u ms, zlib %u ms, using %s\n", (unsigned) (tinflTime / 1000),
+                 (unsigned) (zlibTime / 1000), inflate_backend_name(config->backend));
+    // Not a backend of its own: a way of splitting big entries across cores
+    WHBLogPrintf("Parallel inflate: %u ms, %s\n", (unsigned) (parallelTime / 1000),
+                 config->parallel ? "used for big entries" : "not used");
+    return true;
+}
+
+// What an earlier start measured, false if nothing did or the version changed
+static bool loadConfig(InflateConfig *config) {
+    FILE *file = fopen(INFLATE_CACHE_PATH, "r");
+    if (!file)
+        return false;
+
+    char version[64];
+    int backend, parallel;
+    bool ok = fgets(version, sizeof(version), file) && strcmp(version, INFLATE_CACHE_VERSION "\n") == 0 &&
+              fscanf(file, "%d %d", &backend, &parallel) == 2 && (backend == INFLATE_TINFL || backend == INFLATE_ZLIB);
+    fclose(file);
+    if (ok) {
+        config->backend = (InflateBackend) backend;
+        config->parallel = parallel != 0;
+    }
+    return ok;
+}
+
+static void saveConfig(const InflateConfig *config) {
+    // The first start may well come before wiiu/ exists
+    char dir[MAX_FILENAME];
+    const char *last = strrchr(INFLATE_CACHE_PATH, '/');
+    if (last && (size_t) (last - INFLATE_CACHE_PATH) < sizeof(dir)) {
+        memcpy(dir, INFLATE_CACHE_PATH, last - INFLATE_CACHE_PATH);
+        dir[last - INFLATE_CACHE_PATH] = '\0';
+        mkdir_p(dir, 0777);
+    }
+
+    FILE *file = fopen(INFLATE_CACHE_PATH, "w");
+    if (!file)
+        return;
+    fprintf(file, "%s\n%d %d\n", INFLATE_CACHE_VERSION, (int) config->backend, config->parallel ? 1 : 0);
+    fclose(file);
+}
+#endif
+
+InflateConfig inflate_select() {
+    InflateConfig config = INFLATE_DEFAULT_CONFIG;
+#ifndef INFLATE_BACKEND
+    static bool selected = false;
+    static InflateConfig measured;
+    if (!selected) {
+        // Generating, deflating and inflating the sample takes a while, so
+        // that only happens the first time
+        if (loadConfig(&measured)) {
+            WHBLogPrintf("Inflate: using %s, parallel inflate %s\n", inflate_backend_name(measured.backend),
+                         measured.parallel ? "for big entries" : "off");
+        } else if (benchmark(&measured)) {
+            saveConfig(&measured);
+        }
+        selected = true;
+    }
+    config = measured;
+#endif
+    return config;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "miniz/miniz.h"
+
+typedef struct z_stream_s z_stream;
+
+typedef enum InflateBackend {
+    INFLATE_TINFL, // miniz's tinfl
+    INFLATE_ZLIB   // inflate() of the linked zlib, on raw deflate
+} InflateBackend;
+
+// What extraction inflates with. Defining INFLATE_BACKEND (and optionally
+// INFLATE_PARALLEL) at build time fixes it, otherwise inflate_select()
+// benchmarks the backends on the first start and keeps the outcome in
+// INFLATE_CACHE_PATH until INFLATE_CACHE_VERSION changes.
+typedef struct InflateConfig {
+    // For entries inflated piece by piece while they're read
+    InflateBackend backend;
+    // Whether big entries in memory go through parallel_inflate() instead
+    bool parallel;
+} InflateConfig;
+
+#ifdef INFLATE_BACKEND
+#ifndef INFLATE_PARALLEL
+#define INFLATE_PARALLEL 1
+#endif
+#define INFLATE_DEFAULT_CONFIG {INFLATE_BACKEND, INFLATE_PARALLEL}
+#else
+#define INFLATE_DEFAULT_CONFIG {INFLATE_TINFL, true}
+#endif
+
+// Uncompressed size of the generated data the backends are timed on, big
+// enough for parallel_inflate() to spread it over every core
+#define INFLATE_BENCH_SIZE (6 * 1024 * 1024) // 6 MB
+
+#ifndef INFLATE_CACHE_PATH
+#define INFLATE_CACHE_PATH "/vol/external01/wiiu/setup-inflate.txt"
+#endif
+// First line of the cache. Bump it whenever a change to the backends or
+// parallel_inflate() could change which one wins, so it's measured again.
+#define INFLATE_CACHE_VERSION "1"
+
+// One raw deflate stream at a time through either backend, with the calling
+// convention of tinfl_decompress(): out is the start of a power of two window
+// which output wraps around in, unless TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF
+// is set, and TINFL_FLAG_HAS_MORE_INPUT and TINFL_FLAG_COMPUTE_CRC32 mean the
+// same. The state is allocated once and reused for every stream.
+class StreamInflater {
+public:
+    StreamInflater();
+    ~StreamInflater();
+
+    bool init(InflateBackend backend);
+    // Starts the next stream
+    void reset();
+    tinfl_status run(const uint8_t *in, size_t *inSize, uint8_t *outStart, uint8_t *outNext, size_t *outSize,
+                     mz_uint32 flags);
+    // CRC-32 of everything inflated since reset() with TINFL_FLAG_COMPUTE_CRC32
+    uint32_t crc32() const;
+
+private:
+    InflateBackend backend;
+    tinfl_decompressor *tinfl;
+    z_stream *zlib;
+    uint32_t crc;
+};
+
+const char *inflate_backend_name(InflateBackend backend);
+
+// The build time choice, or else the fastest backend on this machine,
+// measured once per INFLATE_CACHE_VERSION and remembered after that
+InflateConfig inflate_select();
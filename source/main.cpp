@@ -1,5 +1,3 @@
-#include <curl/curl.h>
-
 #include <coreinit/memheap.h>
 #include <sysapp/launch.h>
 
@@ -20,25 +18,35 @@
 #include "input.h"
 #include "state.h"
 
+#include "download.h"
+#include "extract.h"
 #include "kernel.h"
-#include "miniz/miniz.h"
+#include "memory.h"
 
-#define ARRAY_LENGTH(array) (sizeof((array)) / sizeof((array)[0]))
-#define IO_BUFSIZE          (128 * 1024) // 128 KB
-#define MAX_FILENAME        256
+#define ARRAY_LENGTH(array)      (sizeof((array)) / sizeof((array)[0]))
+#define MAX_PACKAGES             8
+#define MAX_CONCURRENT_DOWNLOADS 4
 
 const char *skip_file_list[] = {"manifest.install", "info.json",
                                 "versions.json", "screen1.png",
                                 "screen2.png", "src"};
+// App Store metadata and sources shipped inside wiiubru and fortheusers zips
+static const SkipFilter storeSkipFilter(skip_file_list, ARRAY_LENGTH(skip_file_list));
 
 static int cursorPos = 0;
+static ExtractMode extractMode = EXTRACT_ALL;
+static const char *extractModeNames[] = {"Overwrite", "Keep if same size",
+                                         "Keep if same size and CRC-32"};
 
 extern "C" void __init_wut_malloc();
 
-// Initialize correct heaps for CustomRPXLoader
+// Initialize correct heaps for CustomRPXLoader. The out handles are left
+// alone so its base heaps stay in use, and the MEM1 and MEM2 heaps are
+// carved out of those.
 extern "C" void __preinit_user(MEMHeapHandle *outMem1, MEMHeapHandle *outFG,
                                MEMHeapHandle *outMem2) {
     __init_wut_malloc();
+    memory_init();
 }
 
 static inline void drawToScreen(const char *text) {
@@ -46,204 +54,154 @@ static inline void drawToScreen(const char *text) {
     WHBLogConsoleDraw();
 }
 
-static int initSocket(void *ptr, curl_socket_t socket, curlsocktype type) {
-    int o = 1;
-
-    // Activate WinScale
-    int r = setsockopt(socket, SOL_SOCKET, SO_WINSCALE, &o, sizeof(o));
-    if (r != 0) {
-        WHBLogPrintf("initSocket: Error setting WinScale: %d", r);
-        return CURL_SOCKOPT_ERROR;
-    }
-
-    // Activate TCP SAck
-    r = setsockopt(socket, SOL_SOCKET, SO_TCPSACK, &o, sizeof(o));
-    if (r != 0) {
-        WHBLogPrintf("initSocket: Error setting TCP SAck: %d", r);
-        return CURL_SOCKOPT_ERROR;
-    }
-
-    // Disable slowstart. Should be more important fo a server but doesn't hurt a
-    // client, too
-    r = setsockopt(socket, SOL_SOCKET, 0x4000, &o, sizeof(o));
-    if (r != 0) {
-        WHBLogPrintf("initSocket: Error setting Noslowstart: %d", r);
-        return CURL_SOCKOPT_ERROR;
-    }
-
-    o = 0;
-    // Disable TCP keepalive - libCURL default
-    r = setsockopt(socket, SOL_SOCKET, SO_KEEPALIVE, &o, sizeof(o));
-    if (r != 0) {
-        WHBLogPrintf("initSocket: Error setting TCP nodelay: %d", r);
-        return CURL_SOCKOPT_ERROR;
-    }
-
-    o = IO_BUFSIZE;
-    // Set receive buffersize
-    r = setsockopt(socket, SOL_SOCKET, SO_RCVBUF, &o, sizeof(o));
-    if (r != 0) {
-        WHBLogPrintf("initSocket: Error setting RBS: %d", r);
-        return CURL_SOCKOPT_ERROR;
-    }
-
-    return CURL_SOCKOPT_OK;
+static size_t streamwritefunction(void *ptr, size_t size, size_t nmemb,
+                                  void *extractor) {
+    if (!((ZipStreamExtractor *) extractor)->write(ptr, size * nmemb))
+        return 0;
+    return size * nmemb;
 }
 
-static size_t writefunction(void *ptr, size_t size, size_t nmemb,
-                            void *stream) {
-    size_t written = fwrite(ptr, size, nmemb, (FILE *) stream);
-    return written;
+static bool streamsizefunction(uint64_t size, void *extractor) {
+    return ((ZipStreamExtractor *) extractor)->checkSpace(size);
 }
 
-int mkdir_p(const char *dir, const mode_t mode) {
-    char tmp[MAX_FILENAME];
-    char *p = NULL;
-    struct stat sb;
-    size_t len;
-
-    /* copy path */
-    len = strnlen(dir, MAX_FILENAME);
-    if (len == 0 || len == MAX_FILENAME) {
-        return -1;
-    }
-    memcpy(tmp, dir, len);
-    tmp[len] = '\0';
+typedef struct Package {
+    const char *name;
+    const char *url;
+    // Destination of plain files, temporary file for ZIPs which aren't
+    // streamed and don't fit in memory
+    const char *path;
+    const char *cert;
+    bool extract;
+    // Entries which aren't extracted, or NULL to extract everything
+    const SkipFilter *skip;
+} Package;
+
+// Extracts a package which was downloaded into memory, or into its path if it
+// didn't fit there, and removes that file again
+static bool extractDownload(const Package *package, const DownloadBuffer *memory,
+                            const ExtractOptions *options) {
+    if (memory->data())
+        return extract_package_mem(memory->data(), memory->size(), package->name, options) == 0;
+    bool ok = extract_package(package->path, options) == 0;
+    remove(package->path);
+    return ok;
+}
 
-    /* remove trailing slash */
-    if (tmp[len - 1] == '/') {
-        tmp[len - 1] = '\0';
-    }
+// Replaces path with a file downloaded next to it
+static bool moveIntoPlace(const char *part, const char *path) {
+    remove(path);
+    if (rename(part, path) == 0)
+        return true;
+    WHBLogPrintf("Error moving %s into place", path);
+    remove(part);
+    return false;
+}
 
-    /* check if path exists and is a directory */
-    if (stat(tmp, &sb) == 0) {
-        if (S_ISDIR(sb.st_mode)) {
-            return 0;
+// Downloads all packages concurrently, but applies them to the SD card one
+// after another in their order, like installing them one by one would: they
+// share the wiiu/ tree, and a later package may replace files of an earlier
+// one. The first package is extracted while it is being received, on a
+// thread of its own. The other archives are downloaded into memory, or to
+// path if they don't fit, and other files next to their path, and each is
+// extracted or moved into place once the packages before it are done. If the
+// first archive's layout can't be streamed, it's downloaded again the same
+// way before the others are applied.
+static bool installPackages(DownloadSession &session, const Package *packages,
+                            int count) {
+    ZipStreamExtractor *extractor = NULL;
+    DownloadBuffer *buffers[MAX_PACKAGES] = {};
+    char parts[MAX_PACKAGES][MAX_FILENAME];
+    int ids[MAX_PACKAGES];
+    DirCache dirs;
+    ExtractOptions options[MAX_PACKAGES];
+    InflateConfig inflate = inflate_select();
+    bool ok = true;
+
+    // The archives after the first share what may be kept in memory
+    int archives = 0;
+    for (int i = 1; i < count; i++)
+        archives += packages[i].extract ? 1 : 0;
+    size_t bufferLimit = archives ? download_memory_limit() / archives : 0;
+
+    for (int i = 0; i < count; i++) {
+        WHBLogPrintf("Downloading %s...", packages[i].name);
+        parts[i][0] = '\0';
+        if (packages[i].extract)
+            options[i] = {&dirs, packages[i].skip, extractMode, EXTRACT_PRELOAD_LIMIT, inflate};
+        if (i == 0 && packages[i].extract) {
+            extractor = new ZipStreamExtractor(&options[i]);
+            // Inflating and writing happen off the thread curl runs on, which
+            // would otherwise stop reading every socket while the SD card is busy
+            extractor->startThread(Thread::currentCore() + 1);
+            ids[i] = session.add(packages[i].url, packages[i].cert,
+                                 streamwritefunction, extractor, streamsizefunction);
+        } else if (packages[i].extract) {
+            buffers[i] = new DownloadBuffer(bufferLimit);
+            ids[i] = session.addFile(packages[i].url, packages[i].path,
+                                     packages[i].cert, buffers[i]);
+        } else if (i == 0) {
+            ids[i] = session.addFile(packages[i].url, packages[i].path,
+                                     packages[i].cert);
+        } else {
+            snprintf(parts[i], sizeof(parts[i]), "%s.part", packages[i].path);
+            ids[i] = session.addFile(packages[i].url, parts[i], packages[i].cert);
         }
     }
+    WHBLogConsoleDraw();
 
-    /* recursive mkdir */
-    for (p = tmp + 1; *p; p++) {
-        if (*p == '/') {
-            *p = 0;
-            /* test path */
-            if (stat(tmp, &sb) != 0) {
-                /* path does not exist - create directory */
-                if (mkdir(tmp, mode) < 0) {
-                    return -1;
-                }
-            } else if (!S_ISDIR(sb.st_mode)) {
-                /* not a directory */
-                return -1;
-            }
-            *p = '/';
-        }
-    }
-    /* test path */
-    if (stat(tmp, &sb) != 0) {
-        /* path does not exist - create directory */
-        if (mkdir(tmp, mode) < 0) {
-            return -1;
+    session.run(MAX_CONCURRENT_DOWNLOADS);
+
+    // The fallback download below reuses the session's job slots
+    bool failed[MAX_PACKAGES];
+    bool retry = false;
+    for (int i = 0; i < count; i++)
+        failed[i] = (ids[i] < 0) || (session.result(ids[i]) != 0);
+
+    // Freeing the stream's MEM1 dictionary before any archive is extracted
+    // the usual way, which wants all cores and MEM1 to itself
+    if (extractor) {
+        if (extractor->finish()) {
+            failed[0] = false;
+        } else {
+            // Downloading it again would need the same space on the same card
+            if (extractor->outOfSpace())
+                WHBLogPrintf("Not enough free space for %s", packages[0].name);
+            retry = extractor->unsupported();
+            failed[0] = true;
         }
-    } else if (!S_ISDIR(sb.st_mode)) {
-        /* not a directory */
-        return -1;
+        delete extractor;
     }
-    return 0;
-}
 
-int extract_package(const char *zipfile) {
-    mz_zip_archive zip;
-    memset(&zip, 0, sizeof(zip));
-    if (!mz_zip_reader_init_file(&zip, zipfile, 0)) {
-        WHBLogPrintf("Error opening zip file: %s\n", zipfile);
-        return -1;
-    }
-    for (int i = 0; i < (int) mz_zip_reader_get_num_files(&zip); i++) {
-        mz_zip_archive_file_stat file_stat;
-        if (!mz_zip_reader_file_stat(&zip, i, &file_stat)) {
-            WHBLogPrintf("Error reading zip file: %s\n", zipfile);
-            return -1;
+    // A failed package doesn't stop the others, every one is reported
+    for (int i = 0; i < count; i++) {
+        if (i == 0 && retry) {
+            // Kept in MEM2 if it fits, skipping the round trip through the SD card
+            buffers[i] = new DownloadBuffer(download_memory_limit());
+            WHBLogPrintf("Downloading %s again to extract it...", packages[i].name);
+            WHBLogConsoleDraw();
+            failed[i] = session.downloadFile(packages[i].url, packages[i].path,
+                                             packages[i].cert, buffers[i]) != 0;
         }
-        if (!mz_zip_reader_is_file_a_directory(&zip, i)) {
-            char *filename = (char *) malloc(strlen(file_stat.m_filename) + 1);
-            if (!filename) {
-                WHBLogPrintf("Error allocating filename\n");
-                return -1;
-            }
-            sprintf(filename, "%s", file_stat.m_filename);
-            char *last = strrchr(filename, '/');
-            if (last) {
-                *last = '\0';
-                mkdir_p(filename, 0777);
-                *last = '/';
-            }
-            if (!mz_zip_reader_extract_to_file(&zip, i, filename, 0)) {
-                WHBLogPrintf("Error extracting zip file: %s\n", zipfile);
-                free(filename);
-                return -1;
-            }
-            free(filename);
+        if (buffers[i]) {
+            if (failed[i])
+                remove(packages[i].path);
+            else
+                failed[i] = !extractDownload(&packages[i], buffers[i], &options[i]);
+            delete buffers[i];
+        } else if (parts[i][0]) {
+            if (failed[i])
+                remove(parts[i]);
+            else
+                failed[i] = !moveIntoPlace(parts[i], packages[i].path);
         }
-    }
-    mz_zip_reader_end(&zip);
-    return 0;
-}
-
-static int downloadFile(const char *url, const char *path, const char *cert) {
-    CURLcode res = curl_global_init(CURL_GLOBAL_DEFAULT);
-    if (res != CURLE_OK) {
-        WHBLogPrintf("curl_global_init: %d", res);
-        return 1;
-    }
-
-    // Start a curl session
-    CURL *curl = curl_easy_init();
-    if (!curl) {
-        drawToScreen("curl_easy_init: failed");
-        curl_global_cleanup();
-        return 1;
-    }
-
-    // Use the certificate bundle in the romfs
-    curl_easy_setopt(curl, CURLOPT_CAINFO, cert);
-
-    // Enable optimizations
-    curl_easy_setopt(curl, CURLOPT_SOCKOPTFUNCTION, initSocket);
-
-    // Follow redirects
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-
-    // Set the custom write function
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writefunction);
-
-    // Set the download URL
-    curl_easy_setopt(curl, CURLOPT_URL, url);
-
-    drawToScreen("Starting download...");
-
-    // Perform the download
-    FILE *file = fopen(path, "wb");
-    if (file) {
-        // write the page body to this file handle
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, file);
-
-        drawToScreen("Writing...");
-        // get it!
-        res = curl_easy_perform(curl);
-        if (res != CURLE_OK) {
-            WHBLogPrintf("curl_easy_perform: %d", res);
-            return 1;
+        if (failed[i]) {
+            WHBLogPrintf("Error while downloading %s", packages[i].name);
+            ok = false;
         }
-
-        // close the header file
-        fclose(file);
     }
-
-    // Done, clean up and exit
-    curl_easy_cleanup(curl);
-    curl_global_cleanup();
-    return 0;
+    WHBLogConsoleDraw();
+    return ok;
 }
 
 static inline void drawHeader() {
@@ -276,131 +234,69 @@ int main() {
         WHBLogPrintf("%c Download Tiramisu", cursorPos == 0 ? '>' : ' ');
         WHBLogPrintf("%c Download vWii Homebrew files", cursorPos == 1 ? '>' : ' ');
         WHBLogPrintf("%c Download Aroma", cursorPos == 2 ? '>' : ' ');
+        WHBLogPrint("");
+        WHBLogPrintf("  Existing files (+): %s", extractModeNames[extractMode]);
         WHBLogConsoleDraw();
         if (input.get(TRIGGER, PAD_BUTTON_DOWN) && cursorPos != 2)
             cursorPos++;
         if (input.get(TRIGGER, PAD_BUTTON_UP) && cursorPos != 0)
             cursorPos--;
+        if (input.get(TRIGGER, PAD_BUTTON_PLUS))
+            extractMode = (ExtractMode) ((extractMode + 1) % (EXTRACT_CRC32 + 1));
         if (input.get(TRIGGER, PAD_BUTTON_A))
             break;
     }
 
-    if ((cursorPos == 0) && input.get(TRIGGER, PAD_BUTTON_A)) {
-        drawToScreen("Downloading Tiramisu...");
-
-        if (downloadFile(
-                    "https://github.com/wiiu-env/Tiramisu/releases/download/v0.1/"
-                    "environmentloader-7194938+wiiu-nanddumper-payload-5c5ec09+fw_img_"
-                    "loader-c2da326+payloadloaderinstaller-98367a9+tiramisu-7b881d3."
-                    "zip",
-                    "/vol/external01/tiramisu.zip", "romfs:/github-com.pem") == 1) {
-            drawToScreen("Error while downloading Tiramisu");
-            goto done;
-        }
-
-        drawToScreen("Extracting Tiramisu...");
-        extract_package("/vol/external01/tiramisu.zip");
-
-        drawToScreen("Downloading Sigpatches...");
-
-        if (downloadFile("https://github.com/marco-calautti/SigpatchesModuleWiiU/"
-                         "releases/latest/download/01_sigpatches.rpx",
-                         "/vol/external01/wiiu/environments/tiramisu/modules/setup/"
-                         "01_sigpatches.rpx",
-                         "romfs:/github-com.pem") == 1) {
-            drawToScreen("Error while downloading Sigpatches");
-            goto done;
-        }
-
-        drawToScreen("Downloading Homebrew App Store...");
-
-        if (downloadFile("http://wiiubru.com/appstore/zips/appstore.zip",
-                         "/vol/external01/appstore.zip",
-                         "romfs:/wiiubru-com.pem") == 1) {
-            drawToScreen("Error while downloading Homebrew App Store");
-            goto done;
-        }
-
-        drawToScreen("Extracting Homebrew App Store...");
-
-        extract_package("/vol/external01/appstore.zip");
-
-        drawToScreen("Downloading SaveMii Mod WUT Port...");
-
-        if (downloadFile("https://wiiu.cdn.fortheusers.org/zips/SaveMiiModWUTPort.zip", "/vol/external01/savemii.zip", "romfs:/wiiubru-com.pem") == 1) {
-            drawToScreen("Error while downloading SaveMii Mod WUT Port");
-            goto done;
-        }
-
-        drawToScreen("Extracting SaveMii Mod WUT Port...");
-
-        extract_package("/vol/external01/savemii.zip");
-
-        drawToScreen("Cleaning files...");
+    DownloadSession session;
 
-        remove("/vol/external01/tiramisu.zip");
-        remove("/vol/external01/appstore.zip");
-        remove("/vol/external01/savemii.zip");
+    if ((cursorPos == 0) && input.get(TRIGGER, PAD_BUTTON_A)) {
+        const Package packages[] = {
+                {"Tiramisu",
+                 "https://github.com/wiiu-env/Tiramisu/releases/download/v0.1/"
+                 "environmentloader-7194938+wiiu-nanddumper-payload-5c5ec09+fw_img_"
+                 "loader-c2da326+payloadloaderinstaller-98367a9+tiramisu-7b881d3."
+                 "zip",
+                 "/vol/external01/tiramisu.zip", "romfs:/github-com.pem", true},
+                {"Sigpatches",
+                 "https://github.com/marco-calautti/SigpatchesModuleWiiU/"
+                 "releases/latest/download/01_sigpatches.rpx",
+                 "/vol/external01/wiiu/environments/tiramisu/modules/setup/"
+                 "01_sigpatches.rpx",
+                 "romfs:/github-com.pem", false},
+                {"Homebrew App Store",
+                 "http://wiiubru.com/appstore/zips/appstore.zip",
+                 "/vol/external01/appstore.zip", "romfs:/wiiubru-com.pem", true,
+                 &storeSkipFilter},
+                {"SaveMii Mod WUT Port",
+                 "https://wiiu.cdn.fortheusers.org/zips/SaveMiiModWUTPort.zip",
+                 "/vol/external01/savemii.zip", "romfs:/wiiubru-com.pem", true,
+                 &storeSkipFilter},
+        };
+        installPackages(session, packages, ARRAY_LENGTH(packages));
     } else if ((cursorPos == 1) && input.get(TRIGGER, PAD_BUTTON_A)) {
-        drawToScreen("Downloading Tiramisu...");
-
-        if (downloadFile(
-                    "https://github.com/wiiu-env/Tiramisu/releases/download/v0.1/"
-                    "environmentloader-7194938+wiiu-nanddumper-payload-5c5ec09+fw_img_"
-                    "loader-c2da326+payloadloaderinstaller-98367a9+tiramisu-7b881d3."
-                    "zip",
-                    "/vol/external01/tiramisu.zip", "romfs:/github-com.pem") == 1) {
-            drawToScreen("Error while downloading Tiramisu");
-            goto done;
-        }
-
-        drawToScreen("Extracting Tiramisu...");
-
-        extract_package("/vol/external01/tiramisu.zip");
-
-        drawToScreen("Downloading compat-installer...");
-
-        if (downloadFile("https://github.com/Xpl0itU/vwii-compat-installer/"
-                         "releases/download/v1.2/compat_installer.rpx",
-                         "/vol/external01/wiiu/apps/compat-installer.rpx",
-                         "romfs:/github-com.pem") == 1) {
-            drawToScreen("Error while downloading compat-installer");
-            goto done;
-        }
-
-        drawToScreen("Downloading Patched IOS 80 Installer for vWii...");
-
-        if (downloadFile("https://wiiu.hacks.guide/docs/files/"
-                         "Patched_IOS80_Installer_for_vWii.zip",
-                         "/vol/external01/Patched_IOS80_Installer_for_vWii.zip",
-                         "romfs:/wiiu-hacks-guide.pem") == 1) {
-            drawToScreen("Error while downloading Patched IOS 80 Installer for vWii");
-            goto done;
-        }
-
-        drawToScreen("Extracting Patched IOS 80 Installer for vWii...");
-
-        extract_package("/vol/external01/Patched_IOS80_Installer_for_vWii.zip");
-
-        drawToScreen("Downloading d2x cIOS Installer...");
-
-        if (downloadFile(
-                    "https://wiiu.hacks.guide/docs/files/d2x_cIOS_Installer.zip",
-                    "/vol/external01/d2x_cIOS_Installer.zip",
-                    "romfs:/wiiu-hacks-guide.pem") == 1) {
-            drawToScreen("Error while downloading d2x cIOS Installer");
-            goto done;
-        }
-
-        drawToScreen("Extracting d2x cIOS Installer...");
-
-        extract_package("/vol/external01/d2x_cIOS_Installer.zip");
-
-        drawToScreen("Cleaning files...");
-
-        remove("/vol/external01/tiramisu.zip");
-        remove("/vol/external01/Patched_IOS80_Installer_for_vWii.zip");
-        remove("/vol/external01/d2x_cIOS_Installer.zip");
+        const Package packages[] = {
+                {"Tiramisu",
+                 "https://github.com/wiiu-env/Tiramisu/releases/download/v0.1/"
+                 "environmentloader-7194938+wiiu-nanddumper-payload-5c5ec09+fw_img_"
+                 "loader-c2da326+payloadloaderinstaller-98367a9+tiramisu-7b881d3."
+                 "zip",
+                 "/vol/external01/tiramisu.zip", "romfs:/github-com.pem", true},
+                {"compat-installer",
+                 "https://github.com/Xpl0itU/vwii-compat-installer/"
+                 "releases/download/v1.2/compat_installer.rpx",
+                 "/vol/external01/wiiu/apps/compat-installer.rpx",
+                 "romfs:/github-com.pem", false},
+                {"Patched IOS 80 Installer for vWii",
+                 "https://wiiu.hacks.guide/docs/files/"
+                 "Patched_IOS80_Installer_for_vWii.zip",
+                 "/vol/external01/Patched_IOS80_Installer_for_vWii.zip",
+                 "romfs:/wiiu-hacks-guide.pem", true},
+                {"d2x cIOS Installer",
+                 "https://wiiu.hacks.guide/docs/files/d2x_cIOS_Installer.zip",
+                 "/vol/external01/d2x_cIOS_Installer.zip",
+                 "romfs:/wiiu-hacks-guide.pem", true},
+        };
+        installPackages(session, packages, ARRAY_LENGTH(packages));
     } else if ((cursorPos == 2) && input.get(TRIGGER, PAD_BUTTON_A)) {
         bool nandDumperSelected = false, fwimgloaderSelected = false;
         bool bloopairSelected = false, wiiloadSelected = false;
@@ -462,103 +358,49 @@ int main() {
             if (input.get(TRIGGER, PAD_BUTTON_PLUS))
                 break;
         }
-        drawToScreen("Downloading Payloads...");
-
-        char url[1024];
-        sprintf(url,
+        char payloadsUrl[1024];
+        sprintf(payloadsUrl,
                 "https://aroma.foryour.cafe/api/"
                 "download?packages=environmentloader%s%s",
                 nandDumperSelected ? ",wiiu-nanddumper-payload" : "",
                 fwimgloaderSelected ? ",fw_img_loader" : "");
 
-        if (downloadFile(url, "/vol/external01/payloads.zip",
-                         "romfs:/foryour-cafe.pem") == 1) {
-            drawToScreen("Error while downloading Payloads");
-            goto done;
-        }
-
-        drawToScreen("Extracting Payloads...");
-
-        extract_package("/vol/external01/payloads.zip");
-
-        drawToScreen("Downloading Base Aroma...");
-
-        if (downloadFile(
-                    "https://aroma.foryour.cafe/api/download?packages=base-aroma",
-                    "/vol/external01/base.zip", "romfs:/foryour-cafe.pem") == 1) {
-            drawToScreen("Error while downloading Base Aroma");
-            goto done;
-        }
-
-        drawToScreen("Extracting Base Aroma...");
-
-        extract_package("/vol/external01/base.zip");
-
-        drawToScreen("Downloading Plugins and Modules...");
-
-        sprintf(url, "https://aroma.foryour.cafe/api/download?packages=%s%s%s%s%s",
+        char pluginsUrl[1024];
+        sprintf(pluginsUrl, "https://aroma.foryour.cafe/api/download?packages=%s%s%s%s%s",
                 bloopairSelected ? "bloopair" : "",
                 wiiloadSelected ? ",wiiload" : "", ftpiiuSelected ? ",ftpiiu" : "",
                 sdcafiineSelected ? ",sdcafiine" : "",
                 usbSerialLoggingSelected ? ",usbseriallogger" : "");
 
-        if (downloadFile(url, "/vol/external01/plugins.zip",
-                         "romfs:/foryour-cafe.pem") == 1) {
-            drawToScreen("Error while downloading Plugins and Modules");
-            goto done;
-        }
-
-        drawToScreen("Extracting Plugins and Modules...");
-
-        extract_package("/vol/external01/plugins.zip");
-
-        drawToScreen("Downloading Sigpatches...");
-
-        if (downloadFile("https://github.com/marco-calautti/SigpatchesModuleWiiU/"
-                         "releases/latest/download/01_sigpatches.rpx",
-                         "/vol/external01/wiiu/environments/aroma/modules/setup/"
-                         "01_sigpatches.rpx",
-                         "romfs:/github-com.pem") == 1) {
-            drawToScreen("Error while downloading Sigpatches");
-            goto done;
-        }
-
-        drawToScreen("Downloading Homebrew App Store...");
-
-        if (downloadFile("http://wiiubru.com/appstore/zips/appstore.zip",
-                         "/vol/external01/appstore.zip",
-                         "romfs:/wiiubru-com.pem") == 1) {
-            drawToScreen("Error while downloading Homebrew App Store");
-            goto done;
-        }
-
-        drawToScreen("Extracting Homebrew App Store...");
-
-        extract_package("/vol/external01/appstore.zip");
-
-        drawToScreen("Downloading SaveMii Mod WUT Port...");
-
-        if (downloadFile(
-                    "https://wiiu.cdn.fortheusers.org/zips/SaveMiiModWUTPort-wuhb.zip",
-                    "/vol/external01/savemii.zip", "romfs:/wiiubru-com.pem") == 1) {
-            drawToScreen("Error while downloading SaveMii Mod WUT Port");
-            goto done;
-        }
-
-        drawToScreen("Extracting SaveMii Mod WUT Port...");
-
-        extract_package("/vol/external01/savemii.zip");
-
-        drawToScreen("Cleaning files...");
-
-        remove("/vol/external01/payloads.zip");
-        remove("/vol/external01/base.zip");
-        remove("/vol/external01/plugins.zip");
-        remove("/vol/external01/appstore.zip");
-        remove("/vol/external01/savemii.zip");
+        const Package packages[] = {
+                {"Payloads", payloadsUrl, "/vol/external01/payloads.zip",
+                 "romfs:/foryour-cafe.pem", true},
+                {"Base Aroma",
+                 "https://aroma.foryour.cafe/api/download?packages=base-aroma",
+                 "/vol/external01/base.zip", "romfs:/foryour-cafe.pem", true},
+                {"Plugins and Modules", pluginsUrl, "/vol/external01/plugins.zip",
+                 "romfs:/foryour-cafe.pem", true},
+                {"Sigpatches",
+                 "https://github.com/marco-calautti/SigpatchesModuleWiiU/"
+                 "releases/latest/download/01_sigpatches.rpx",
+                 "/vol/external01/wiiu/environments/aroma/modules/setup/"
+                 "01_sigpatches.rpx",
+                 "romfs:/github-com.pem", false},
+                {"Homebrew App Store",
+                 "http://wiiubru.com/appstore/zips/appstore.zip",
+                 "/vol/external01/appstore.zip", "romfs:/wiiubru-com.pem", true,
+                 &storeSkipFilter},
+                {"SaveMii Mod WUT Port",
+                 "https://wiiu.cdn.fortheusers.org/zips/SaveMiiModWUTPort-wuhb.zip",
+                 "/vol/external01/savemii.zip", "romfs:/wiiubru-com.pem", true,
+                 &storeSkipFilter},
+        };
+        installPackages(session, packages, ARRAY_LENGTH(packages));
     }
 
-done:;
+    session.close();
+    memory_log_stats();
+
     WHBLogPrint("");
     drawToScreen("Done, press HOME to exit");
 
@@ -567,6 +409,8 @@ done:;
     }
 
     romfsExit();
+    // Before the foreground, and MEM1 with it, is released
+    memory_exit();
     shutdownState();
     ProcUIShutdown();
 
@@ -0,0 +1,212 @@
+#include <whb/log.h>
+
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+
+#include "memory.h"
+
+#ifdef __WIIU__
+#include <coreinit/memexpheap.h>
+#include <coreinit/memfrmheap.h>
+#include <coreinit/memheap.h>
+
+typedef struct Heap {
+    MEMHeapHandle handle;
+    // Base heap it was carved from, to give it back in memory_exit()
+    MEMHeapHandle base;
+    uint8_t *start;
+    size_t size;
+    std::atomic<size_t> used;
+    std::atomic<size_t> peak;
+} Heap;
+
+// Only zero-initialized, memory_init() runs before any constructor would
+static Heap heaps[2];
+
+// Takes up to max bytes from a base heap, leaving reserve bytes in it
+static void *carve(MEMHeapHandle base, size_t reserve, size_t max, size_t *size) {
+    if (!base)
+        return NULL;
+    bool frame = base->tag == MEM_FRAME_HEAP_TAG;
+    if (!frame && base->tag != MEM_EXPANDED_HEAP_TAG)
+        return NULL;
+
+    size_t avail = frame ? MEMGetAllocatableSizeForFrmHeapEx(base, MEMORY_ALIGNMENT)
+                         : MEMGetAllocatableSizeForExpHeapEx(base, MEMORY_ALIGNMENT);
+    if (avail < reserve + MEMORY_HEAP_MIN)
+        return NULL;
+    *size = (avail - reserve < max) ? avail - reserve : max;
+    // From the frame heap's tail, so freeing it later leaves the head alone
+    return frame ? MEMAllocFromFrmHeapEx(base, *size, -MEMORY_ALIGNMENT)
+                 : MEMAllocFromExpHeapEx(base, *size, MEMORY_ALIGNMENT);
+}
+
+static void release(MEMHeapHandle base, void *memory) {
+    if (base->tag == MEM_FRAME_HEAP_TAG)
+        MEMFreeToFrmHeap(base, MEM_FRM_HEAP_FREE_TAIL);
+    else
+        MEMFreeToExpHeap(base, memory);
+}
+
+static void createHeap(Heap *heap, MEMBaseHeapType type, size_t reserve, size_t max) {
+    size_t size = 0;
+    MEMHeapHandle base = MEMGetBaseHeapHandle(type);
+    void *memory = carve(base, reserve, max, &size);
+    if (!memory)
+        return;
+    // Allocated from every core
+    heap->handle = MEMCreateExpHeapEx(memory, size, MEM_HEAP_FLAG_USE_LOCK);
+    if (!heap->handle) {
+        release(base, memory);
+        return;
+    }
+    heap->base = base;
+    heap->start = (uint8_t *) memory;
+    heap->size = size;
+}
+
+void memory_init() {
+    createHeap(&heaps[MEMORY_MEM1], MEM_BASE_HEAP_MEM1, MEMORY_MEM1_RESERVE, MEMORY_MEM1_SIZE);
+    createHeap(&heaps[MEMORY_MEM2], MEM_BASE_HEAP_MEM2, MEMORY_MEM2_RESERVE, MEMORY_MEM2_SIZE);
+}
+
+void memory_exit() {
+    for (Heap &heap : heaps) {
+        if (!heap.handle)
+            continue;
+        MEMHeapHandle handle = heap.handle;
+        // memory_free() of a block that outlived the heap is a no-op from now on
+        heap.handle = NULL;
+        MEMDestroyExpHeap(handle);
+        release(heap.base, heap.start);
+    }
+}
+
+static void addUsed(Heap *heap, size_t size) {
+    size_t used = heap->used += size;
+    size_t peak = heap->peak.load();
+    while (used > peak && !heap->peak.compare_exchange_weak(peak, used))
+        ;
+}
+
+static Heap *findHeap(const void *ptr) {
+    for (Heap &heap : heaps) {
+        if (heap.start && (const uint8_t *) ptr >= heap.start && (const uint8_t *) ptr < heap.start + heap.size)
+            return &heap;
+    }
+    return NULL;
+}
+
+static void *heapAlloc(Heap *heap, size_t size, size_t alignment) {
+    if (!heap->handle)
+        return NULL;
+    void *ptr = MEMAllocFromExpHeapEx(heap->handle, size ? size : 1, alignment);
+    if (ptr)
+        addUsed(heap, MEMGetSizeForMBlockExpHeap(ptr));
+    return ptr;
+}
+
+void *memory_alloc(MemoryHeap heap, size_t size, size_t alignment) {
+    void *ptr = NULL;
+    if (heap == MEMORY_MEM1)
+        ptr = heapAlloc(&heaps[MEMORY_MEM1], size, alignment);
+    if (!ptr)
+        ptr = heapAlloc(&heaps[MEMORY_MEM2], size, alignment);
+    if (!ptr)
+        ptr = memalign(alignment, size);
+    return ptr;
+}
+
+void *memory_realloc(MemoryHeap heap, void *ptr, size_t size) {
+    if (!ptr)
+        return memory_alloc(heap, size);
+    Heap *owner = findHeap(ptr);
+    if (!owner)
+        return realloc(ptr, size);
+    if (!owner->handle)
+        return NULL;
+
+    size_t old = MEMGetSizeForMBlockExpHeap(ptr);
+    size_t resized = MEMResizeForMBlockExpHeap(owner->handle, ptr, size);
+    if (resized) {
+        owner->used -= old;
+        addUsed(owner, resized);
+        return ptr;
+    }
+
+    void *moved = memory_alloc(heap, size);
+    if (!moved)
+        return NULL;
+    memcpy(moved, ptr, (old < size) ? old : size);
+    memory_free(ptr);
+    return moved;
+}
+
+void memory_free(void *ptr) {
+    if (!ptr)
+        return;
+    Heap *heap = findHeap(ptr);
+    if (!heap) {
+        free(ptr);
+        return;
+    }
+    if (!heap->handle)
+        return;
+    heap->used -= MEMGetSizeForMBlockExpHeap(ptr);
+    MEMFreeToExpHeap(heap->handle, ptr);
+}
+
+size_t memory_allocatable(MemoryHeap heap) {
+    if (heaps[heap].handle)
+        return MEMGetAllocatableSizeForExpHeapEx(heaps[heap].handle, 4);
+    if (heap == MEMORY_MEM1)
+        return 0;
+    // What memory_alloc() falls back to
+    MEMHeapHandle base = MEMGetBaseHeapHandle(MEM_BASE_HEAP_MEM2);
+    return base ? MEMGetAllocatableSizeForExpHeapEx(base, 4) : 0;
+}
+
+MemoryStats memory_stats(MemoryHeap heap) {
+    return {heaps[heap].size, heaps[heap].used.load(), heaps[heap].peak.load()};
+}
+#else
+void memory_init() {}
+
+void memory_exit() {}
+
+void *memory_alloc(MemoryHeap heap, size_t size, size_t alignment) {
+    return memalign(alignment, size);
+}
+
+void *memory_realloc(MemoryHeap heap, void *ptr, size_t size) {
+    return realloc(ptr, size);
+}
+
+void memory_free(void *ptr) {
+    free(ptr);
+}
+
+size_t memory_allocatable(MemoryHeap heap) {
+    return 0;
+}
+
+MemoryStats memory_stats(MemoryHeap heap) {
+    return {0, 0, 0};
+}
+#endif
+
+void memory_log_stats() {
+    static const char *const names[] = {"MEM1", "MEM2"};
+    for (int i = MEMORY_MEM1; i <= MEMORY_MEM2; i++) {
+        MemoryStats stats = memory_stats((MemoryHeap) i);
+        if (!stats.size) {
+            WHBLogPrintf("%s: no heap, using the default heap\n", names[i]);
+            continue;
+        }
+        WHBLogPrintf("%s: %u KB in use, %u KB peak of %u KB\n", names[i], (unsigned) (stats.used / 1024),
+                     (unsigned) (stats.peak / 1024), (unsigned) (stats.size / 1024));
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MEMORY_ALIGNMENT 0x40
+
+// MEM1 heap size, if MEM1 has that much to spare
+#define MEMORY_MEM1_SIZE    (8 * 1024 * 1024)  // 8 MB
+// MEM1 left to its frame heap, for the log console's screen buffers
+#define MEMORY_MEM1_RESERVE (12 * 1024 * 1024) // 12 MB
+// MEM2 heap size, if MEM2 has that much to spare. Downloads are capped by
+// what's allocatable, so this only bounds what they can take from others.
+#define MEMORY_MEM2_SIZE    (512 * 1024 * 1024) // 512 MB
+// MEM2 left to the default heap, for curl, mbedTLS, thread stacks and
+// everything else which goes through malloc(). Big buffers of our own use
+// memory_alloc(MEMORY_MEM2) instead.
+#define MEMORY_MEM2_RESERVE (32 * 1024 * 1024) // 32 MB
+// Heaps smaller than this aren't worth creating
+#define MEMORY_HEAP_MIN (1024 * 1024) // 1 MB
+
+typedef enum MemoryHeap {
+    MEMORY_MEM1, // Small, hot working sets: inflate windows and state, CRC tables
+    MEMORY_MEM2  // Bulk buffers: downloads, preloaded archives, I/O buffers
+} MemoryHeap;
+
+typedef struct MemoryStats {
+    // 0 if the heap couldn't be created
+    size_t size;
+    size_t used;
+    // Most that was ever in use at once
+    size_t peak;
+} MemoryStats;
+
+// Carves an expanded heap out of MEM1 and another one out of the default
+// MEM2 heap. Called from __preinit_user(), before static initialization, so
+// even the first allocations land in them. A host build has neither heap.
+void memory_init();
+// Destroys both heaps and returns their memory to the base heaps. Called
+// before the foreground is released; nothing may use the heaps afterwards.
+void memory_exit();
+
+// Allocates from heap. A full MEM1 heap falls back to MEM2, and a full or
+// missing MEM2 heap to the default heap.
+void *memory_alloc(MemoryHeap heap, size_t size, size_t alignment = MEMORY_ALIGNMENT);
+// Grows or shrinks a block in place if possible, or moves it within heap
+void *memory_realloc(MemoryHeap heap, void *ptr, size_t size);
+// Frees a block from memory_alloc() or memory_realloc(), whichever heap it's in
+void memory_free(void *ptr);
+
+// Largest block heap could hand out right now
+size_t memory_allocatable(MemoryHeap heap);
+MemoryStats memory_stats(MemoryHeap heap);
+// Logs the size, current use and peak use of both heaps
+void memory_log_stats();
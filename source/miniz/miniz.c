@@ -2053,6 +2053,26 @@ void tdefl_compressor_free(tdefl_compressor *pComp) {
 
 #ifndef MINIZ_NO_INFLATE_APIS
 
+/* Match copy kernels, picked at compile time. TINFL_COPY_8/16 move 8/16 bytes, the source may only overlap the destination from behind if it starts at least that */
+/* far back. Espresso has no vector unit, but its FPU moves 8 bytes per lfd/stfd without looking at them. Those are only used between word aligned addresses, */
+/* other matches go through two unaligned lwz/stw pairs which the integer unit handles in hardware. */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define TINFL_COPY_8(d, s)  _mm_storel_epi64((__m128i *) (d), _mm_loadl_epi64((const __m128i *) (s)))
+#define TINFL_COPY_16(d, s) _mm_storeu_si128((__m128i *) (d), _mm_loadu_si128((const __m128i *) (s)))
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define TINFL_COPY_8(d, s)  vst1_u8((d), vld1_u8(s))
+#define TINFL_COPY_16(d, s) vst1q_u8((d), vld1q_u8(s))
+#elif (defined(__powerpc__) || defined(__PPC__)) && defined(__GNUC__) && !defined(_SOFT_FLOAT)
+#define TINFL_COPY_FPU 1
+#define TINFL_COPY_8(d, s)  memcpy(d, s, 8)
+#define TINFL_COPY_16(d, s) memcpy(d, s, 16)
+#else
+#define TINFL_COPY_8(d, s)  memcpy(d, s, 8)
+#define TINFL_COPY_16(d, s) memcpy(d, s, 16)
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -2118,6 +2138,34 @@ extern "C" {
     }                                        \
     MZ_MACRO_END
 
+/* TINFL_REFILL_WORD() tops a 32-bit bit buffer up to 24-31 bits with one unaligned little endian load (a single lwbrx on big endian PowerPC), without branching. */
+/* Only the whole bytes which fit are consumed, the rest of the word lands above num_bits. Those bits are the next input bits, so OR-ing them in again later changes */
+/* nothing, which is why the stored block copy has to clear them. Both refills of the fast loop together read up to 7 bytes, hence the larger input margin. */
+#if TINFL_USE_64BIT_BITBUF
+#define TINFL_FAST_LOOP_MIN_INPUT 4
+#else
+#define TINFL_FAST_LOOP_MIN_INPUT 8
+#define TINFL_REFILL_WORD()                                                  \
+    do {                                                                     \
+        bit_buf |= ((tinfl_bit_buf_t) MZ_READ_LE32(pIn_buf_cur)) << num_bits; \
+        pIn_buf_cur += (31 - num_bits) >> 3;                                 \
+        num_bits |= 24;                                                      \
+    }                                                                        \
+    MZ_MACRO_END
+#endif
+
+/* With TINFL_FLAG_COMPUTE_CRC32, output is folded into the CRC whenever TINFL_CRC_STEP bytes have piled up since pCrc_cur, while they're still in L1. */
+/* A single call can inflate a whole 1 MB buffer, far more than the Espresso's 32 KB L1 holds. */
+#define TINFL_CRC_STEP 8192
+#define TINFL_CRC_UPDATE(min_len)                                                                                    \
+    do {                                                                                                             \
+        if ((decomp_flags & TINFL_FLAG_COMPUTE_CRC32) && ((size_t) (pOut_buf_cur - pCrc_cur) >= (min_len))) {        \
+            r->m_check_crc32 = (mz_uint32) mz_crc32(r->m_check_crc32, pCrc_cur, (size_t) (pOut_buf_cur - pCrc_cur)); \
+            pCrc_cur = pOut_buf_cur;                                                                                 \
+        }                                                                                                            \
+    }                                                                                                                \
+    MZ_MACRO_END
+
 /* TINFL_HUFF_BITBUF_FILL() is only used rarely, when the number of bytes remaining in the input buffer falls below 2. */
 /* It reads just enough bytes from the input stream that are needed to decode the next Huffman code (and absolutely no more). It works by trying to fully decode a */
 /* Huffman code by using whatever bits are currently present in the bit buffer. If this fails, it reads another byte, and tries again until it succeeds or until the */
@@ -2184,6 +2232,50 @@ static void tinfl_clear_tree(tinfl_decompressor *r) {
         MZ_CLEAR_ARR(r->m_tree_2);
 }
 
+#if TINFL_COPY_FPU
+static MZ_FORCEINLINE mz_uint8 *tinfl_copy_fpu(mz_uint8 *pDst, const mz_uint8 *pSrc, size_t n, mz_uint dist) {
+    double a, b;
+    while (n >= 16 && dist >= 16) {
+        __asm__("lfd %0,0(%2)\n\tlfd %1,8(%2)" : "=&f"(a), "=f"(b) : "b"(pSrc), "m"(*(const mz_uint8(*)[16]) pSrc));
+        __asm__("stfd %1,0(%3)\n\tstfd %2,8(%3)" : "=m"(*(mz_uint8(*)[16]) pDst) : "f"(a), "f"(b), "b"(pDst));
+        pDst += 16;
+        pSrc += 16;
+        n -= 16;
+    }
+    while (n >= 8) {
+        __asm__("lfd %0,0(%1)" : "=f"(a) : "b"(pSrc), "m"(*(const mz_uint8(*)[8]) pSrc));
+        __asm__("stfd %1,0(%2)" : "=m"(*(mz_uint8(*)[8]) pDst) : "f"(a), "b"(pDst));
+        pDst += 8;
+        pSrc += 8;
+        n -= 8;
+    }
+    while (n--)
+        *pDst++ = *pSrc++;
+    return pDst;
+}
+#endif
+
+/* Copies a match of n >= 8 bytes whose source starts at least 8 bytes before pDst, or anywhere after it. Sources closer than 16 bytes go 8 at a time so every */
+/* load only sees bytes which were stored by an earlier step. */
+static MZ_FORCEINLINE mz_uint8 *tinfl_copy_match(mz_uint8 *pDst, const mz_uint8 *pSrc, size_t n, mz_uint dist) {
+#if TINFL_COPY_FPU
+    if (!(((size_t) pDst ^ (size_t) pSrc) & 3)) {
+        for (; (size_t) pDst & 3; n--)
+            *pDst++ = *pSrc++;
+        return tinfl_copy_fpu(pDst, pSrc, n, dist);
+    }
+#endif
+    if (dist >= 16) {
+        for (; n >= 16; n -= 16, pDst += 16, pSrc += 16)
+            TINFL_COPY_16(pDst, pSrc);
+    }
+    for (; n >= 8; n -= 8, pDst += 8, pSrc += 8)
+        TINFL_COPY_8(pDst, pSrc);
+    while (n--)
+        *pDst++ = *pSrc++;
+    return pDst;
+}
+
 tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_next, size_t *pIn_buf_size, mz_uint8 *pOut_buf_start, mz_uint8 *pOut_buf_next, size_t *pOut_buf_size, const mz_uint32 decomp_flags) {
     static const mz_uint16 s_length_base[31] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258, 0, 0};
     static const mz_uint8 s_length_extra[31] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0, 0, 0};
@@ -2200,6 +2292,7 @@ tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_nex
     tinfl_bit_buf_t bit_buf;
     const mz_uint8 *pIn_buf_cur = pIn_buf_next, *const pIn_buf_end = pIn_buf_next + *pIn_buf_size;
     mz_uint8 *pOut_buf_cur = pOut_buf_next, *const pOut_buf_end = pOut_buf_next ? pOut_buf_next + *pOut_buf_size : NULL;
+    const mz_uint8 *pCrc_cur = pOut_buf_next;
     size_t out_buf_size_mask = (decomp_flags & TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF) ? (size_t) -1 : ((pOut_buf_next - pOut_buf_start) + *pOut_buf_size) - 1, dist_from_out_buf_start;
 
     /* Ensure the output buffer's size is a power of 2, unless the output buffer is large enough to hold the entire output file (in which case it doesn't matter). */
@@ -2225,6 +2318,7 @@ tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_nex
 
     bit_buf = num_bits = dist = counter = num_extra = r->m_zhdr0 = r->m_zhdr1 = 0;
     r->m_z_adler32 = r->m_check_adler32 = 1;
+    r->m_check_crc32 = MZ_CRC32_INIT;
     if (decomp_flags & TINFL_FLAG_PARSE_ZLIB_HEADER) {
         TINFL_GET_BYTE(1, r->m_zhdr0);
         TINFL_GET_BYTE(2, r->m_zhdr1);
@@ -2267,11 +2361,15 @@ tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_nex
                     TINFL_CR_RETURN(38, (decomp_flags & TINFL_FLAG_HAS_MORE_INPUT) ? TINFL_STATUS_NEEDS_MORE_INPUT : TINFL_STATUS_FAILED_CANNOT_MAKE_PROGRESS);
                 }
                 n = MZ_MIN(MZ_MIN((size_t) (pOut_buf_end - pOut_buf_cur), (size_t) (pIn_buf_end - pIn_buf_cur)), counter);
+                n = MZ_MIN(n, (size_t) TINFL_CRC_STEP);
                 TINFL_MEMCPY(pOut_buf_cur, pIn_buf_cur, n);
                 pIn_buf_cur += n;
                 pOut_buf_cur += n;
                 counter -= (mz_uint) n;
+                TINFL_CRC_UPDATE(TINFL_CRC_STEP);
             }
+            /* Bits above num_bits may still hold look-ahead from TINFL_REFILL_WORD() which the copy skipped past */
+            bit_buf &= (tinfl_bit_buf_t) ((((mz_uint64) 1) << num_bits) - (mz_uint64) 1);
         } else if (r->m_type == 3) {
             TINFL_CR_RETURN_FOREVER(10, TINFL_STATUS_FAILED);
         } else {
@@ -2385,7 +2483,8 @@ tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_nex
             for (;;) {
                 mz_uint8 *pSrc;
                 for (;;) {
-                    if (((pIn_buf_end - pIn_buf_cur) < 4) || ((pOut_buf_end - pOut_buf_cur) < 2)) {
+                    TINFL_CRC_UPDATE(TINFL_CRC_STEP);
+                    if (((pIn_buf_end - pIn_buf_cur) < TINFL_FAST_LOOP_MIN_INPUT) || ((pOut_buf_end - pOut_buf_cur) < 2)) {
                         TINFL_HUFF_DECODE(23, counter, r->m_look_up[0], r->m_tree_0);
                         if (counter >= 256)
                             break;
@@ -2403,11 +2502,7 @@ tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_nex
                             num_bits += 32;
                         }
 #else
-                        if (num_bits < 15) {
-                            bit_buf |= (((tinfl_bit_buf_t) MZ_READ_LE16(pIn_buf_cur)) << num_bits);
-                            pIn_buf_cur += 2;
-                            num_bits += 16;
-                        }
+                        TINFL_REFILL_WORD();
 #endif
                         if ((sym2 = r->m_look_up[0][bit_buf & (TINFL_FAST_LOOKUP_SIZE - 1)]) >= 0)
                             code_len = sym2 >> 9;
@@ -2424,11 +2519,7 @@ tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_nex
                             break;
 
 #if !TINFL_USE_64BIT_BITBUF
-                        if (num_bits < 15) {
-                            bit_buf |= (((tinfl_bit_buf_t) MZ_READ_LE16(pIn_buf_cur)) << num_bits);
-                            pIn_buf_cur += 2;
-                            num_bits += 16;
-                        }
+                        TINFL_REFILL_WORD();
 #endif
                         if ((sym2 = r->m_look_up[0][bit_buf & (TINFL_FAST_LOOKUP_SIZE - 1)]) >= 0)
                             code_len = sym2 >> 9;
@@ -2486,30 +2577,14 @@ tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_nex
                         *pOut_buf_cur++ = pOut_buf_start[(dist_from_out_buf_start++ - dist) & out_buf_size_mask];
                     }
                     continue;
+                } else if ((counter >= 8) && (dist >= 8)) {
+                    pOut_buf_cur = tinfl_copy_match(pOut_buf_cur, pSrc, counter, dist);
+                    continue;
+                } else if (dist == 1) {
+                    TINFL_MEMSET(pOut_buf_cur, *pSrc, counter);
+                    pOut_buf_cur += counter;
+                    continue;
                 }
-#if MINIZ_USE_UNALIGNED_LOADS_AND_STORES
-                else if ((counter >= 9) && (counter <= dist)) {
-                    const mz_uint8 *pSrc_end = pSrc + (counter & ~7);
-                    do {
-#ifdef MINIZ_UNALIGNED_USE_MEMCPY
-                        memcpy(pOut_buf_cur, pSrc, sizeof(mz_uint32) * 2);
-#else
-                        ((mz_uint32 *) pOut_buf_cur)[0] = ((const mz_uint32 *) pSrc)[0];
-                        ((mz_uint32 *) pOut_buf_cur)[1] = ((const mz_uint32 *) pSrc)[1];
-#endif
-                        pOut_buf_cur += 8;
-                    } while ((pSrc += 8) < pSrc_end);
-                    if ((counter &= 7) < 3) {
-                        if (counter) {
-                            pOut_buf_cur[0] = pSrc[0];
-                            if (counter > 1)
-                                pOut_buf_cur[1] = pSrc[1];
-                            pOut_buf_cur += counter;
-                        }
-                        continue;
-                    }
-                }
-#endif
                 while (counter > 2) {
                     pOut_buf_cur[0] = pSrc[0];
                     pOut_buf_cur[1] = pSrc[1];
@@ -2596,6 +2671,9 @@ common_exit:
         if ((status == TINFL_STATUS_DONE) && (decomp_flags & TINFL_FLAG_PARSE_ZLIB_HEADER) && (r->m_check_adler32 != r->m_z_adler32))
             status = TINFL_STATUS_ADLER32_MISMATCH;
     }
+    /* Whatever is left since the last TINFL_CRC_STEP */
+    if (status >= 0)
+        TINFL_CRC_UPDATE(1);
     return status;
 }
 
@@ -6987,6 +7065,55 @@ mz_bool mz_zip_reader_file_stat(mz_zip_archive *pZip, mz_uint file_index, mz_zip
     return mz_zip_file_stat_internal(pZip, file_index, mz_zip_get_cdh(pZip, file_index), pStat, NULL);
 }
 
+mz_bool mz_zip_reader_file_view(mz_zip_archive *pZip, mz_uint file_index, mz_zip_archive_file_view *pView) {
+    mz_uint filename_len;
+    const mz_uint8 *p = mz_zip_get_cdh(pZip, file_index);
+    if ((!p) || (!pView))
+        return mz_zip_set_error(pZip, MZ_ZIP_INVALID_PARAMETER);
+
+    filename_len = MZ_READ_LE16(p + MZ_ZIP_CDH_FILENAME_LEN_OFS);
+    pView->m_file_index = file_index;
+    pView->m_bit_flag = MZ_READ_LE16(p + MZ_ZIP_CDH_BIT_FLAG_OFS);
+    pView->m_method = MZ_READ_LE16(p + MZ_ZIP_CDH_METHOD_OFS);
+    pView->m_crc32 = MZ_READ_LE32(p + MZ_ZIP_CDH_CRC32_OFS);
+    pView->m_comp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS);
+    pView->m_uncomp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS);
+    pView->m_local_header_ofs = MZ_READ_LE32(p + MZ_ZIP_CDH_LOCAL_HEADER_OFS);
+    pView->m_dos_time = MZ_READ_LE16(p + MZ_ZIP_CDH_FILE_TIME_OFS);
+    pView->m_dos_date = MZ_READ_LE16(p + MZ_ZIP_CDH_FILE_DATE_OFS);
+    pView->m_pFilename = (const char *) (p + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE);
+    pView->m_filename_len = (mz_uint16) filename_len;
+
+    /* Same checks as mz_zip_reader_is_file_a_directory() and mz_zip_reader_is_file_supported(), without fetching the header again. */
+    pView->m_is_directory = ((filename_len) && (pView->m_pFilename[filename_len - 1] == '/')) ||
+                            ((MZ_READ_LE32(p + MZ_ZIP_CDH_EXTERNAL_ATTR_OFS) & MZ_ZIP_DOS_DIR_ATTRIBUTE_BITFLAG) != 0);
+    pView->m_is_supported = ((pView->m_method == 0) || (pView->m_method == MZ_DEFLATED)) &&
+                            !(pView->m_bit_flag & (MZ_ZIP_GENERAL_PURPOSE_BIT_FLAG_IS_ENCRYPTED | MZ_ZIP_GENERAL_PURPOSE_BIT_FLAG_USES_STRONG_ENCRYPTION | MZ_ZIP_GENERAL_PURPOSE_BIT_FLAG_COMPRESSED_PATCH_FLAG));
+
+    /* Rare zip64 entries take the slow path for their extended information field. */
+    if (MZ_MAX(MZ_MAX(pView->m_comp_size, pView->m_uncomp_size), pView->m_local_header_ofs) == MZ_UINT32_MAX) {
+        mz_zip_archive_file_stat *pStat = (mz_zip_archive_file_stat *) pZip->m_pAlloc(pZip->m_pAlloc_opaque, 1, sizeof(mz_zip_archive_file_stat));
+        if (!pStat)
+            return mz_zip_set_error(pZip, MZ_ZIP_ALLOC_FAILED);
+        if (!mz_zip_file_stat_internal(pZip, file_index, p, pStat, NULL)) {
+            pZip->m_pFree(pZip->m_pAlloc_opaque, pStat);
+            return MZ_FALSE;
+        }
+        pView->m_comp_size = pStat->m_comp_size;
+        pView->m_uncomp_size = pStat->m_uncomp_size;
+        pView->m_local_header_ofs = pStat->m_local_header_ofs;
+        pZip->m_pFree(pZip->m_pAlloc_opaque, pStat);
+    }
+
+    return MZ_TRUE;
+}
+
+#ifndef MINIZ_NO_TIME
+MZ_TIME_T mz_zip_reader_view_time(const mz_zip_archive_file_view *pView) {
+    return mz_zip_dos_to_time_t(pView->m_dos_time, pView->m_dos_date);
+}
+#endif
+
 mz_bool mz_zip_end(mz_zip_archive *pZip) {
     if (!pZip)
         return MZ_FALSE;
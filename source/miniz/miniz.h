@@ -217,12 +217,24 @@
 #endif
 #endif
 
+#if !defined(MINIZ_HAS_64BIT_REGISTERS)
 #if defined(_M_X64) || defined(_WIN64) || defined(__MINGW64__) || defined(_LP64) || defined(__LP64__) || defined(__ia64__) || defined(__x86_64__)
 /* Set MINIZ_HAS_64BIT_REGISTERS to 1 if operations on 64-bit integers are reasonably fast (and don't involve compiler generated calls to helper functions). */
 #define MINIZ_HAS_64BIT_REGISTERS 1
 #else
 #define MINIZ_HAS_64BIT_REGISTERS 0
 #endif
+#endif
+
+/* Set MINIZ_USE_BYTE_REVERSED_LOADS only if not set */
+#if !defined(MINIZ_USE_BYTE_REVERSED_LOADS)
+#if !MINIZ_LITTLE_ENDIAN && (defined(__powerpc__) || defined(__PPC__) || defined(__ppc__))
+/* Big endian PowerPC reads little endian data with a single lhbrx/lwbrx, which also handles unaligned addresses in hardware. */
+#define MINIZ_USE_BYTE_REVERSED_LOADS 1
+#else
+#define MINIZ_USE_BYTE_REVERSED_LOADS 0
+#endif
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -586,9 +598,30 @@ typedef struct mz_dummy_time_t_tag {
 #define MZ_CLEAR_ARR(obj) memset((obj), 0, sizeof(obj))
 #define MZ_CLEAR_PTR(obj) memset((obj), 0, sizeof(*obj))
 
+#ifdef _MSC_VER
+#define MZ_FORCEINLINE __forceinline
+#elif defined(__GNUC__)
+#define MZ_FORCEINLINE __inline__ __attribute__((__always_inline__))
+#else
+#define MZ_FORCEINLINE inline
+#endif
+
 #if MINIZ_USE_UNALIGNED_LOADS_AND_STORES && MINIZ_LITTLE_ENDIAN
 #define MZ_READ_LE16(p) *((const mz_uint16 *) (p))
 #define MZ_READ_LE32(p) *((const mz_uint32 *) (p))
+#elif MINIZ_USE_BYTE_REVERSED_LOADS
+static MZ_FORCEINLINE mz_uint32 mz_read_le16_brx(const void *p) {
+    mz_uint32 v;
+    __asm__("lhbrx %0,0,%1" : "=r"(v) : "r"(p), "m"(*(const mz_uint8(*)[2]) p));
+    return v;
+}
+static MZ_FORCEINLINE mz_uint32 mz_read_le32_brx(const void *p) {
+    mz_uint32 v;
+    __asm__("lwbrx %0,0,%1" : "=r"(v) : "r"(p), "m"(*(const mz_uint8(*)[4]) p));
+    return v;
+}
+#define MZ_READ_LE16(p) mz_read_le16_brx(p)
+#define MZ_READ_LE32(p) mz_read_le32_brx(p)
 #else
 #define MZ_READ_LE16(p) ((mz_uint32) (((const mz_uint8 *) (p))[0]) | ((mz_uint32) (((const mz_uint8 *) (p))[1]) << 8U))
 #define MZ_READ_LE32(p) ((mz_uint32) (((const mz_uint8 *) (p))[0]) | ((mz_uint32) (((const mz_uint8 *) (p))[1]) << 8U) | ((mz_uint32) (((const mz_uint8 *) (p))[2]) << 16U) | ((mz_uint32) (((const mz_uint8 *) (p))[3]) << 24U))
@@ -596,14 +629,6 @@ typedef struct mz_dummy_time_t_tag {
 
 #define MZ_READ_LE64(p) (((mz_uint64) MZ_READ_LE32(p)) | (((mz_uint64) MZ_READ_LE32((const mz_uint8 *) (p) + sizeof(mz_uint32))) << 32U))
 
-#ifdef _MSC_VER
-#define MZ_FORCEINLINE __forceinline
-#elif defined(__GNUC__)
-#define MZ_FORCEINLINE __inline__ __attribute__((__always_inline__))
-#else
-#define MZ_FORCEINLINE inline
-#endif
-
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -821,11 +846,13 @@ extern "C" {
 /* TINFL_FLAG_HAS_MORE_INPUT: If set, there are more input bytes available beyond the end of the supplied input buffer. If clear, the input buffer contains all remaining input. */
 /* TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF: If set, the output buffer is large enough to hold the entire decompressed stream. If clear, the output buffer is at least the size of the dictionary (typically 32KB). */
 /* TINFL_FLAG_COMPUTE_ADLER32: Force adler-32 checksum computation of the decompressed bytes. */
+/* TINFL_FLAG_COMPUTE_CRC32: Compute the CRC-32 of the decompressed bytes (as used by ZIP) inside the decode loop, a few KB at a time while they're still in cache, see tinfl_get_crc32(). */
 enum {
     TINFL_FLAG_PARSE_ZLIB_HEADER = 1,
     TINFL_FLAG_HAS_MORE_INPUT = 2,
     TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF = 4,
-    TINFL_FLAG_COMPUTE_ADLER32 = 8
+    TINFL_FLAG_COMPUTE_ADLER32 = 8,
+    TINFL_FLAG_COMPUTE_CRC32 = 16
 };
 
 /* High level decompression functions: */
@@ -903,6 +930,7 @@ typedef enum {
     }                     \
     MZ_MACRO_END
 #define tinfl_get_adler32(r) (r)->m_check_adler32
+#define tinfl_get_crc32(r)   (r)->m_check_crc32
 
 /* Main low-level decompressor coroutine function. This is the only function actually needed for decompression. All the other functions are just high-level helpers for improved usability. */
 /* This is a universal API, i.e. it can be used as a building block to build any desired higher level decompression API. In the limit case, it can be called once per every byte input or output. */
@@ -933,7 +961,7 @@ typedef mz_uint32 tinfl_bit_buf_t;
 #endif
 
 struct tinfl_decompressor_tag {
-    mz_uint32 m_state, m_num_bits, m_zhdr0, m_zhdr1, m_z_adler32, m_final, m_type, m_check_adler32, m_dist, m_counter, m_num_extra, m_table_sizes[TINFL_MAX_HUFF_TABLES];
+    mz_uint32 m_state, m_num_bits, m_zhdr0, m_zhdr1, m_z_adler32, m_final, m_type, m_check_adler32, m_check_crc32, m_dist, m_counter, m_num_extra, m_table_sizes[TINFL_MAX_HUFF_TABLES];
     tinfl_bit_buf_t m_bit_buf;
     size_t m_dist_from_out_buf_start;
     mz_int16 m_look_up[TINFL_MAX_HUFF_TABLES][TINFL_FAST_LOOKUP_SIZE];
@@ -1027,6 +1055,26 @@ typedef struct
 #endif
 } mz_zip_archive_file_stat;
 
+/* The fields of an entry most extractors need, read straight from the central directory. */
+/* Nothing is copied: m_pFilename points into the archive's central directory, is NOT zero terminated, */
+/* and stays valid until the archive is closed. */
+typedef struct
+{
+    mz_uint32 m_file_index;
+    mz_uint16 m_bit_flag;
+    mz_uint16 m_method;
+    mz_uint32 m_crc32;
+    mz_uint64 m_comp_size;
+    mz_uint64 m_uncomp_size;
+    mz_uint64 m_local_header_ofs;
+    mz_uint16 m_dos_time;
+    mz_uint16 m_dos_date;
+    const char *m_pFilename;
+    mz_uint16 m_filename_len;
+    mz_bool m_is_directory;
+    mz_bool m_is_supported;
+} mz_zip_archive_file_view;
+
 typedef size_t (*mz_file_read_func)(void *pOpaque, mz_uint64 file_ofs, void *pBuf, size_t n);
 typedef size_t (*mz_file_write_func)(void *pOpaque, mz_uint64 file_ofs, const void *pBuf, size_t n);
 typedef mz_bool (*mz_file_needs_keepalive)(void *pOpaque);
@@ -1227,6 +1275,15 @@ MINIZ_EXPORT mz_bool mz_zip_reader_locate_file_v2(mz_zip_archive *pZip, const ch
 /* Returns detailed information about an archive file entry. */
 MINIZ_EXPORT mz_bool mz_zip_reader_file_stat(mz_zip_archive *pZip, mz_uint file_index, mz_zip_archive_file_stat *pStat);
 
+/* Like mz_zip_reader_file_stat(), but only parses the central directory header once and copies nothing, */
+/* which is much cheaper when walking archives with thousands of entries. */
+MINIZ_EXPORT mz_bool mz_zip_reader_file_view(mz_zip_archive *pZip, mz_uint file_index, mz_zip_archive_file_view *pView);
+
+#ifndef MINIZ_NO_TIME
+/* The entry's modification time, which mz_zip_reader_file_view() leaves in DOS format. */
+MINIZ_EXPORT MZ_TIME_T mz_zip_reader_view_time(const mz_zip_archive_file_view *pView);
+#endif
+
 /* MZ_TRUE if the file is in zip64 format. */
 /* A file is considered zip64 if it contained a zip64 end of central directory marker, or if it contained any zip64 extended file information fields in the central directory. */
 MINIZ_EXPORT mz_bool mz_zip_is_zip64(mz_zip_archive *pZip);
@@ -0,0 +1,514 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "memory.h"
+#include "pinflate.h"
+#include "thread.h"
+
+#define PINFLATE_WINDOW    32768
+#define PINFLATE_FAST_BITS 10
+// One chunk per core and round, each this many compressed bytes
+#define PINFLATE_CHUNKS     THREAD_NUM_CORES
+#define PINFLATE_CHUNK_SIZE (1024 * 1024) // 1 MB
+// The known stream is handed to the sink in pieces of about this size
+#define PINFLATE_FLUSH_SIZE (1024 * 1024)
+// A guess which decodes to more than this is given up on
+#define PINFLATE_SPECULATIVE_MAX (16 * 1024 * 1024)
+#define PINFLATE_EMIT_SIZE       (64 * 1024)
+// How far past a guess to look for a block, stored or fixed Huffman data
+// has none to find
+#define PINFLATE_SEARCH_SIZE (128 * 1024)
+
+// Canonical Huffman code. fast holds (length << 9) | symbol for every code
+// of up to PINFLATE_FAST_BITS bits, longer ones are decoded bit by bit.
+typedef struct Huffman {
+    uint16_t fast[1 << PINFLATE_FAST_BITS];
+    uint16_t count[16];
+    uint16_t symbol[288];
+} Huffman;
+
+// Output is 16 bits per byte. Values from 256 on are references to the
+// window before the chunk's start, which isn't known yet while guessing.
+typedef struct Inflater {
+    const uint8_t *src;
+    size_t srcSize;
+    uint64_t bitPos;
+    uint64_t guessBit;
+    uint64_t startBit;
+    uint64_t stopBit;
+    // The first PINFLATE_WINDOW values are the window
+    uint16_t *out;
+    size_t len;
+    size_t cap;
+    bool known;
+    bool final;
+    bool valid;
+    Huffman lengths;
+    Huffman lit;
+    Huffman dist;
+} Inflater;
+
+static const uint16_t lengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27,
+                                        31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                        2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t distBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129,
+                                      193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t distExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6,
+                                      6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+static const uint8_t lengthOrder[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+// Only a code with a single one bit symbol, or none at all, may be
+// incomplete, like zlib and puff
+static bool buildHuffman(Huffman *h, const uint8_t *lengths, int n, bool allowIncomplete) {
+    memset(h->count, 0, sizeof(h->count));
+    for (int i = 0; i < n; i++)
+        h->count[lengths[i]]++;
+
+    int left = 1;
+    for (int len = 1; len < 16; len++) {
+        left <<= 1;
+        left -= h->count[len];
+        if (left < 0)
+            return false;
+    }
+    if (left > 0 && (!allowIncomplete || n - h->count[0] != h->count[1]))
+        return false;
+
+    uint16_t offsets[16];
+    offsets[1] = 0;
+    for (int len = 1; len < 15; len++)
+        offsets[len + 1] = offsets[len] + h->count[len];
+    for (int i = 0; i < n; i++) {
+        if (lengths[i])
+            h->symbol[offsets[lengths[i]]++] = i;
+    }
+
+    memset(h->fast, 0, sizeof(h->fast));
+    int code = 0, index = 0;
+    for (int len = 1; len <= PINFLATE_FAST_BITS; len++) {
+        for (int i = 0; i < h->count[len]; i++, code++) {
+            // Deflate sends codes from the top bit down
+            int reversed = 0;
+            for (int bit = 0; bit < len; bit++)
+                reversed |= ((code >> bit) & 1) << (len - 1 - bit);
+            for (int j = reversed; j < (1 << PINFLATE_FAST_BITS); j += 1 << len)
+                h->fast[j] = (len << 9) | h->symbol[index + i];
+        }
+        index += h->count[len];
+        code <<= 1;
+    }
+    return true;
+}
+
+static int slowDecode(const Huffman *h, uint64_t bits) {
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len < 16; len++) {
+        code |= bits & 1;
+        bits >>= 1;
+        int count = h->count[len];
+        if (code - count < first)
+            return (len << 9) | h->symbol[index + (code - first)];
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+static inline int decodeSymbol(const Huffman *h, uint64_t bits) {
+    uint16_t entry = h->fast[bits & ((1 << PINFLATE_FAST_BITS) - 1)];
+    return entry ? entry : slowDecode(h, bits);
+}
+
+// Built during static initialization, before any thread uses them
+typedef struct FixedCodes {
+    Huffman lit;
+    Huffman dist;
+
+    FixedCodes() {
+        uint8_t lengths[288];
+        memset(lengths, 8, 144);
+        memset(lengths + 144, 9, 112);
+        memset(lengths + 256, 7, 24);
+        memset(lengths + 280, 8, 8);
+        buildHuffman(&lit, lengths, 288, false);
+        memset(lengths, 5, 32);
+        buildHuffman(&dist, lengths, 32, false);
+    }
+} FixedCodes;
+
+static const FixedCodes fixedCodes;
+
+// At least 57 bits from bitPos on, zeros past the end
+static inline uint64_t peekBits(const Inflater *s) {
+    uint64_t byte = s->bitPos >> 3;
+    uint64_t v = 0;
+    if (byte + 8 <= s->srcSize) {
+        memcpy(&v, s->src + byte, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        v = __builtin_bswap64(v);
+#endif
+    } else {
+        for (int i = 0; i < 8 && byte + i < s->srcSize; i++)
+            v |= (uint64_t) s->src[byte + i] << (8 * i);
+    }
+    return v >> (s->bitPos & 7);
+}
+
+static bool reserve(Inflater *s, size_t n) {
+    if (s->len + n <= s->cap)
+        return true;
+    size_t cap = std::max(s->cap * 2, s->len + n);
+    uint16_t *out = (uint16_t *) memory_realloc(MEMORY_MEM2, s->out, cap * sizeof(uint16_t));
+    if (!out)
+        return false;
+    s->out = out;
+    s->cap = cap;
+    return true;
+}
+
+static bool storedBlock(Inflater *s) {
+    uint64_t byte = (s->bitPos + 7) >> 3;
+    if (byte + 4 > s->srcSize)
+        return false;
+    const uint8_t *p = s->src + byte;
+    unsigned len = p[0] | (p[1] << 8);
+    if (len != (~(p[2] | (p[3] << 8)) & 0xFFFF))
+        return false;
+    byte += 4;
+    if (byte + len > s->srcSize || !reserve(s, len))
+        return false;
+
+    for (unsigned i = 0; i < len; i++)
+        s->out[s->len + i] = s->src[byte + i];
+    s->len += len;
+    s->bitPos = (byte + len) * 8;
+    return true;
+}
+
+static bool readDynamic(Inflater *s) {
+    uint64_t bits = peekBits(s);
+    int nlit = (bits & 31) + 257;
+    int ndist = ((bits >> 5) & 31) + 1;
+    int ncode = ((bits >> 10) & 15) + 4;
+    s->bitPos += 14;
+    if (nlit > 286 || ndist > 30)
+        return false;
+
+    uint8_t lengths[286 + 30];
+    memset(lengths, 0, 19);
+    bits = peekBits(s);
+    for (int i = 0; i < ncode; i++)
+        lengths[lengthOrder[i]] = (bits >> (3 * i)) & 7;
+    s->bitPos += 3 * ncode;
+    if (!buildHuffman(&s->lengths, lengths, 19, false))
+        return false;
+
+    int n = 0;
+    while (n < nlit + ndist) {
+        bits = peekBits(s);
+        int entry = decodeSymbol(&s->lengths, bits);
+        if (entry < 0)
+            return false;
+        int used = entry >> 9, symbol = entry & 511;
+        bits >>= used;
+        if (symbol < 16) {
+            lengths[n++] = symbol;
+            s->bitPos += used;
+            continue;
+        }
+
+        int value = 0, repeat;
+        if (symbol == 16) {
+            if (!n)
+                return false;
+            value = lengths[n - 1];
+            repeat = 3 + (bits & 3);
+            used += 2;
+        } else if (symbol == 17) {
+            repeat = 3 + (bits & 7);
+            used += 3;
+        } else {
+            repeat = 11 + (bits & 127);
+            used += 7;
+        }
+        if (n + repeat > nlit + ndist)
+            return false;
+        memset(lengths + n, value, repeat);
+        n += repeat;
+        s->bitPos += used;
+    }
+
+    // Without an end of block code the block can't end
+    return s->bitPos <= (uint64_t) s->srcSize * 8 && lengths[256] && buildHuffman(&s->lit, lengths, nlit, true) &&
+           buildHuffman(&s->dist, lengths + nlit, ndist, true);
+}
+
+static bool decodeCodes(Inflater *s, const Huffman *lit, const Huffman *dist) {
+    uint64_t endBit = (uint64_t) s->srcSize * 8;
+    for (;;) {
+        if (!reserve(s, 258))
+            return false;
+        uint64_t bits = peekBits(s);
+        int entry = decodeSymbol(lit, bits);
+        if (entry < 0)
+            return false;
+        int used = entry >> 9, symbol = entry & 511;
+        bits >>= used;
+
+        if (symbol < 256) {
+            s->out[s->len++] = symbol;
+            s->bitPos += used;
+            // Past the end peekBits() reads zeros, which may well be literals
+            if (s->bitPos > endBit)
+                return false;
+            continue;
+        }
+        if (symbol == 256) {
+            s->bitPos += used;
+            return s->bitPos <= endBit;
+        }
+
+        symbol -= 257;
+        if (symbol >= 29)
+            return false;
+        int length = lengthBase[symbol] + (bits & ((1 << lengthExtra[symbol]) - 1));
+        bits >>= lengthExtra[symbol];
+        used += lengthExtra[symbol];
+
+        entry = decodeSymbol(dist, bits);
+        if (entry < 0 || (entry & 511) >= 30)
+            return false;
+        symbol = entry & 511;
+        bits >>= entry >> 9;
+        used += entry >> 9;
+        unsigned distance = distBase[symbol] + (bits & ((1 << distExtra[symbol]) - 1));
+        used += distExtra[symbol];
+        s->bitPos += used;
+        if (distance > s->len || s->bitPos > endBit)
+            return false;
+
+        uint16_t *out = s->out + s->len;
+        const uint16_t *from = out - distance;
+        if (distance >= (unsigned) length) {
+            memcpy(out, from, length * sizeof(uint16_t));
+        } else if (distance == 1) {
+            std::fill(out, out + length, *from);
+        } else {
+            // Overlapping copies repeat the last distance values
+            for (int i = 0; i < length; i++)
+                out[i] = from[i];
+        }
+        s->len += length;
+    }
+}
+
+static bool decodeBlock(Inflater *s) {
+    uint64_t bits = peekBits(s);
+    s->final = bits & 1;
+    s->bitPos += 3;
+    switch ((bits >> 1) & 3) {
+        case 0:
+            return storedBlock(s);
+        case 1:
+            return decodeCodes(s, &fixedCodes.lit, &fixedCodes.dist);
+        case 2:
+            return readDynamic(s) && decodeCodes(s, &s->lit, &s->dist);
+    }
+    return false;
+}
+
+// Hands everything after the window to sink and keeps the last
+// PINFLATE_WINDOW values as the new window
+static bool emit(Inflater *s, uint8_t *bytes, InflateSink sink, void *arg) {
+    for (size_t i = PINFLATE_WINDOW; i < s->len;) {
+        size_t n = std::min((size_t) PINFLATE_EMIT_SIZE, s->len - i);
+        for (size_t j = 0; j < n; j++) {
+            uint16_t value = s->out[i + j];
+            if (value > 255)
+                return false;
+            bytes[j] = value;
+        }
+        if (!sink(arg, bytes, n))
+            return false;
+        i += n;
+    }
+    memmove(s->out, s->out + s->len - PINFLATE_WINDOW, PINFLATE_WINDOW * sizeof(uint16_t));
+    s->len = PINFLATE_WINDOW;
+    return true;
+}
+
+// Decodes whole blocks until one ends at or after stopBit. A known stream
+// is emitted as it goes, a guessed one gives up when it gets too big.
+static bool decodeUntil(Inflater *s, uint64_t stopBit, uint8_t *bytes, InflateSink sink, void *arg) {
+    while (!s->final && s->bitPos < stopBit) {
+        if (!decodeBlock(s))
+            return false;
+        if (s->known && s->len >= PINFLATE_WINDOW + PINFLATE_FLUSH_SIZE && !emit(s, bytes, sink, arg))
+            return false;
+        if (!s->known && s->len > PINFLATE_SPECULATIVE_MAX)
+            return false;
+    }
+    return true;
+}
+
+// Whether the code length code of a dynamic header at bits is complete,
+// which rules out almost every position that isn't a real block start
+static bool plausibleHeader(uint64_t bits) {
+    if ((bits & 7) != 4 || ((bits >> 3) & 31) > 29 || ((bits >> 8) & 31) > 29)
+        return false;
+    int ncode = ((bits >> 13) & 15) + 4;
+    bits >>= 17;
+    int left = 0;
+    for (int i = 0; i < ncode; i++, bits >>= 3) {
+        if (bits & 7)
+            left += 1 << (7 - (bits & 7));
+    }
+    return left == 1 << 7;
+}
+
+// The first bit in [from, to) where a non-final dynamic block starts which
+// decodes cleanly and isn't followed by the reserved block type
+static bool findBlock(Inflater *s, uint64_t from, uint64_t to) {
+    for (uint64_t bit = from; bit < to; bit++) {
+        s->bitPos = bit;
+        if (!plausibleHeader(peekBits(s)))
+            continue;
+
+        s->len = PINFLATE_WINDOW;
+        if (!decodeBlock(s) || ((peekBits(s) >> 1) & 3) == 3)
+            continue;
+        s->bitPos = bit;
+        s->len = PINFLATE_WINDOW;
+        s->final = false;
+        return true;
+    }
+    return false;
+}
+
+static void speculate(void *arg) {
+    Inflater *s = (Inflater *) arg;
+    for (int i = 0; i < PINFLATE_WINDOW; i++)
+        s->out[i] = 256 + i;
+    s->len = PINFLATE_WINDOW;
+    s->known = false;
+    s->final = false;
+
+    if (!findBlock(s, s->guessBit, std::min(s->stopBit, s->guessBit + (uint64_t) PINFLATE_SEARCH_SIZE * 8)))
+        return;
+    s->startBit = s->bitPos;
+    s->valid = decodeUntil(s, s->stopBit, NULL, NULL, NULL);
+}
+
+// Speculates on one chunk per round, on its own core. Started once per
+// parallel_inflate() call, a round only takes two events.
+typedef struct Helper {
+    Thread thread;
+    Event start;
+    Event done;
+    // The round's chunk, NULL to make the thread exit
+    Inflater *chunk;
+} Helper;
+
+static void helperRun(void *arg) {
+    Helper *helper = (Helper *) arg;
+    for (;;) {
+        helper->start.wait();
+        if (!helper->chunk)
+            break;
+        speculate(helper->chunk);
+        helper->done.signal();
+    }
+}
+
+// Fills in next's references to the window, which ends where cur is now
+static void resolve(Inflater *next, const Inflater *cur) {
+    const uint16_t *window = cur->out + cur->len - PINFLATE_WINDOW;
+    for (size_t i = PINFLATE_WINDOW; i < next->len; i++) {
+        if (next->out[i] > 255)
+            next->out[i] = window[next->out[i] - 256];
+    }
+    memcpy(next->out, window, PINFLATE_WINDOW * sizeof(uint16_t));
+    next->known = true;
+}
+
+bool parallel_inflate(const uint8_t *src, size_t size, InflateSink sink, void *arg) {
+    Inflater *chunks = (Inflater *) memory_alloc(MEMORY_MEM2, PINFLATE_CHUNKS * sizeof(Inflater));
+    uint8_t *bytes = (uint8_t *) memory_alloc(MEMORY_MEM2, PINFLATE_EMIT_SIZE);
+    bool ok = chunks && bytes;
+    if (chunks)
+        memset(chunks, 0, PINFLATE_CHUNKS * sizeof(Inflater));
+    for (int i = 0; ok && i < PINFLATE_CHUNKS; i++) {
+        chunks[i].src = src;
+        chunks[i].srcSize = size;
+        ok = reserve(&chunks[i], PINFLATE_WINDOW + PINFLATE_FLUSH_SIZE + 258);
+    }
+
+    // chunks[0] always continues the known stream
+    Inflater *cur = chunks;
+    if (ok) {
+        memset(cur->out, 0, PINFLATE_WINDOW * sizeof(uint16_t));
+        cur->len = PINFLATE_WINDOW;
+        cur->known = true;
+    }
+
+    // Fewer helpers than cores just means fewer guesses per round
+    Helper helpers[PINFLATE_CHUNKS - 1];
+    int numHelpers = 0;
+    int core = Thread::currentCore();
+    while (ok && numHelpers < PINFLATE_CHUNKS - 1) {
+        helpers[numHelpers].chunk = NULL;
+        if (!helpers[numHelpers].thread.start(helperRun, &helpers[numHelpers], core + 1 + numHelpers))
+            break;
+        numHelpers++;
+    }
+
+    while (ok && !cur->final) {
+        uint64_t base = cur->bitPos >> 3;
+        int count = 1;
+        while (count <= numHelpers && base + (uint64_t) count * PINFLATE_CHUNK_SIZE < size) {
+            Inflater *s = &chunks[count];
+            s->guessBit = (base + (uint64_t) count * PINFLATE_CHUNK_SIZE) * 8;
+            s->stopBit = s->guessBit + (uint64_t) PINFLATE_CHUNK_SIZE * 8;
+            s->valid = false;
+            count++;
+        }
+
+        for (int i = 1; i < count; i++) {
+            helpers[i - 1].chunk = &chunks[i];
+            helpers[i - 1].start.signal();
+        }
+        ok = decodeUntil(cur, (count > 1) ? chunks[1].guessBit : UINT64_MAX, bytes, sink, arg);
+        for (int i = 1; i < count; i++)
+            helpers[i - 1].done.wait();
+
+        for (int i = 1; ok && i < count && !cur->final; i++) {
+            Inflater *next = &chunks[i];
+            if (next->valid && cur->bitPos == next->startBit) {
+                ok = emit(cur, bytes, sink, arg);
+                resolve(next, cur);
+                std::swap(*cur, *next);
+            } else {
+                // The guess was wrong or found nothing, decode its range here
+                ok = decodeUntil(cur, next->stopBit, bytes, sink, arg);
+            }
+        }
+    }
+    if (ok)
+        ok = emit(cur, bytes, sink, arg) && cur->bitPos <= (uint64_t) size * 8;
+
+    for (int i = 0; i < numHelpers; i++) {
+        helpers[i].chunk = NULL;
+        helpers[i].start.signal();
+        helpers[i].thread.join();
+    }
+
+    for (int i = 0; chunks && i < PINFLATE_CHUNKS; i++)
+        memory_free(chunks[i].out);
+    memory_free(chunks);
+    memory_free(bytes);
+    return ok;
+}
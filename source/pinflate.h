@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Gets the inflated data in order, returns false to stop inflating
+typedef bool (*InflateSink)(void *arg, const uint8_t *data, size_t size);
+
+// Inflates a raw deflate stream which is completely in memory on all cores,
+// so it's only worth it while nothing else runs on them. While this thread
+// decodes, helper threads started once for the call guess where later
+// deflate blocks start and decode from there without the preceding 32 KB
+// window, leaving references into it unresolved. Those are filled in once the data before
+// them is known. A chunk whose guessed start the real decode doesn't land
+// on is decoded serially instead, so bad guesses only cost time.
+// False if the stream is corrupt, memory ran out or the sink failed.
+bool parallel_inflate(const uint8_t *src, size_t size, InflateSink sink, void *arg);
@@ -0,0 +1,158 @@
+#include <malloc.h>
+#include <stdlib.h>
+
+#include "thread.h"
+
+#ifdef __WIIU__
+Thread::Thread() : thread(NULL), stack(NULL), func(NULL), arg(NULL), running(false) {}
+#else
+Thread::Thread() : func(NULL), arg(NULL), running(false) {}
+#endif
+
+Thread::~Thread() {
+    join();
+}
+
+#ifdef __WIIU__
+int Thread::entry(int argc, const char **argv) {
+    Thread *self = (Thread *) argv;
+    self->func(self->arg);
+    return 0;
+}
+
+bool Thread::start(ThreadFunc func, void *arg, int core) {
+    if (running)
+        return false;
+
+    this->func = func;
+    this->arg = arg;
+
+    thread = (OSThread *) memalign(16, sizeof(OSThread));
+    stack = (uint8_t *) memalign(16, THREAD_STACK_SIZE);
+    if (!thread || !stack) {
+        free(thread);
+        free(stack);
+        thread = NULL;
+        stack = NULL;
+        return false;
+    }
+
+    // Same priority as the main thread, on the requested core only
+    if (!OSCreateThread(thread, entry, 0, (char *) this, stack + THREAD_STACK_SIZE, THREAD_STACK_SIZE,
+                        OSGetThreadPriority(OSGetCurrentThread()), (OSThreadAttributes) (1 << (core % THREAD_NUM_CORES)))) {
+        free(thread);
+        free(stack);
+        thread = NULL;
+        stack = NULL;
+        return false;
+    }
+
+    OSResumeThread(thread);
+    running = true;
+    return true;
+}
+
+int Thread::currentCore() {
+    return OSGetCoreId();
+}
+
+void Thread::sleep(uint32_t ms) {
+    OSSleepTicks(OSMillisecondsToTicks(ms));
+}
+
+uint64_t Thread::timeUs() {
+    return OSTicksToMicroseconds(OSGetSystemTime());
+}
+
+Mutex::Mutex() {
+    OSInitMutex(&mutex);
+}
+
+void Mutex::lock() {
+    OSLockMutex(&mutex);
+}
+
+void Mutex::unlock() {
+    OSUnlockMutex(&mutex);
+}
+
+Event::Event() {
+    OSInitEvent(&event, FALSE, OS_EVENT_MODE_AUTO);
+}
+
+void Event::signal() {
+    OSSignalEvent(&event);
+}
+
+void Event::wait() {
+    OSWaitEvent(&event);
+}
+
+void Thread::join() {
+    if (!running)
+        return;
+
+    int result;
+    OSJoinThread(thread, &result);
+    free(thread);
+    free(stack);
+    thread = NULL;
+    stack = NULL;
+    running = false;
+}
+#else
+bool Thread::start(ThreadFunc func, void *arg, int core) {
+    if (running)
+        return false;
+
+    this->func = func;
+    this->arg = arg;
+    thread = std::thread(func, arg);
+    running = true;
+    return true;
+}
+
+int Thread::currentCore() {
+    return 0;
+}
+
+void Thread::sleep(uint32_t ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+uint64_t Thread::timeUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Mutex::Mutex() {}
+
+void Mutex::lock() {
+    mutex.lock();
+}
+
+void Mutex::unlock() {
+    mutex.unlock();
+}
+
+Event::Event() : signaled(false) {}
+
+void Event::signal() {
+    std::lock_guard<std::mutex> lock(mutex);
+    signaled = true;
+    cond.notify_one();
+}
+
+void Event::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait(lock, [this] { return signaled; });
+    signaled = false;
+}
+
+void Thread::join() {
+    if (!running)
+        return;
+
+    thread.join();
+    running = false;
+}
+#endif
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __WIIU__
+#include <coreinit/event.h>
+#include <coreinit/mutex.h>
+#include <coreinit/thread.h>
+#include <coreinit/time.h>
+#else
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+#define THREAD_STACK_SIZE (128 * 1024) // 128 KB
+#define THREAD_NUM_CORES  3
+
+typedef void (*ThreadFunc)(void *arg);
+
+// Worker thread pinned to one core. Uses OSCreateThread on the console and
+// std::thread everywhere else, where the core is only a hint.
+class Thread {
+public:
+    Thread();
+    ~Thread();
+
+    bool start(ThreadFunc func, void *arg, int core);
+    void join();
+
+    static int currentCore();
+    static void sleep(uint32_t ms);
+    // Monotonic clock in microseconds, for timing
+    static uint64_t timeUs();
+
+private:
+#ifdef __WIIU__
+    static int entry(int argc, const char **argv);
+
+    OSThread *thread;
+    uint8_t *stack;
+#else
+    std::thread thread;
+#endif
+    ThreadFunc func;
+    void *arg;
+    bool running;
+};
+
+// Lock shared between Threads, an OSMutex on the console
+class Mutex {
+public:
+    Mutex();
+
+    void lock();
+    void unlock();
+
+private:
+#ifdef __WIIU__
+    OSMutex mutex;
+#else
+    std::mutex mutex;
+#endif
+};
+
+// Wakes a thread blocked in wait() when another one signals it. Resets when
+// wait() returns, and a signal nobody waits for yet is kept for the next
+// wait(), like the auto mode OSEvent it is on the console.
+class Event {
+public:
+    Event();
+
+    void signal();
+    void wait();
+
+private:
+#ifdef __WIIU__
+    OSEvent event;
+#else
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool signaled;
+#endif
+};
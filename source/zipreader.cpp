@@ -0,0 +1,240 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "filewriter.h"
+#include "memory.h"
+#include "zipreader.h"
+
+ZipReader::ZipReader() : fd(-1), fileSize(0), filePos(0), window(NULL), windowOfs(0), windowLen(0) {}
+
+ZipReader::~ZipReader() {
+    close();
+}
+
+bool ZipReader::open(const char *path) {
+    close();
+
+    fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    window = (uint8_t *) memory_alloc(MEMORY_MEM2, ZIP_READER_WINDOW_SIZE, IO_BUFFER_ALIGNMENT);
+    if (fstat(fd, &st) != 0 || !window) {
+        close();
+        return false;
+    }
+    fileSize = st.st_size;
+    filePos = 0;
+    windowOfs = 0;
+    windowLen = 0;
+    return true;
+}
+
+void ZipReader::close() {
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+    memory_free(window);
+    window = NULL;
+    windowLen = 0;
+}
+
+void ZipReader::install(mz_zip_archive *zip) {
+    zip->m_pRead = zipRead;
+    zip->m_pIO_opaque = this;
+}
+
+size_t ZipReader::zipRead(void *opaque, mz_uint64 ofs, void *buf, size_t n) {
+    return ((ZipReader *) opaque)->read(ofs, (uint8_t *) buf, n);
+}
+
+// Reads straight from the file, seeking only if the last read ended elsewhere
+size_t ZipReader::readAt(uint64_t ofs, uint8_t *buf, size_t n) {
+    if (filePos != ofs) {
+        if (lseek(fd, ofs, SEEK_SET) < 0)
+            return 0;
+        filePos = ofs;
+    }
+
+    size_t done = 0;
+    while (done < n) {
+        ssize_t got = ::read(fd, buf + done, n - done);
+        if (got <= 0)
+            break;
+        done += got;
+    }
+    filePos += done;
+    return done;
+}
+
+size_t ZipReader::read(uint64_t ofs, uint8_t *buf, size_t n) {
+    if (ofs >= fileSize)
+        return 0;
+    if (n > fileSize - ofs)
+        n = fileSize - ofs;
+
+    size_t done = 0;
+    while (done < n) {
+        uint64_t pos = ofs + done;
+        if (pos >= windowOfs && pos < windowOfs + windowLen) {
+            size_t k = windowOfs + windowLen - pos;
+            if (k > n - done)
+                k = n - done;
+            memcpy(buf + done, window + (pos - windowOfs), k);
+            done += k;
+            continue;
+        }
+
+        bool sequential = windowLen && pos == windowOfs + windowLen;
+        size_t ahead = sequential ? ZIP_READER_WINDOW_SIZE : ZIP_READER_RANDOM_SIZE;
+        if (n - done >= ahead) {
+            // Big enough to skip the window, like the central directory
+            size_t got = readAt(pos, buf + done, n - done);
+            done += got;
+            break;
+        }
+
+        if (ahead > fileSize - pos)
+            ahead = fileSize - pos;
+        windowOfs = pos;
+        windowLen = readAt(pos, window, ahead);
+        if (!windowLen)
+            break;
+    }
+    return done;
+}
+
+AsyncReader::AsyncReader() : zip(NULL), offset(0), remaining(0), head(0), tail(0), done(false), failed(false), stop(false),
+                             holding(false), started(false) {
+    for (int i = 0; i < ASYNC_READER_BUFFERS; i++)
+        buffers[i] = NULL;
+}
+
+AsyncReader::~AsyncReader() {
+    finish();
+}
+
+bool AsyncReader::start(mz_zip_archive *zip, uint64_t offset, uint64_t size, int core) {
+    finish();
+    this->zip = zip;
+    this->offset = offset;
+    remaining = size;
+    head = tail = 0;
+    done = failed = stop = false;
+    holding = false;
+
+    bool ok = true;
+    for (int i = 0; i < ASYNC_READER_BUFFERS; i++) {
+        buffers[i] = ioBuffers.acquire();
+        if (!buffers[i])
+            ok = false;
+    }
+    if (!ok || !thread.start(run, this, core)) {
+        for (int i = 0; i < ASYNC_READER_BUFFERS; i++) {
+            ioBuffers.release(buffers[i]);
+            buffers[i] = NULL;
+        }
+        return false;
+    }
+    started = true;
+    return true;
+}
+
+void AsyncReader::run(void *arg) {
+    AsyncReader *reader = (AsyncReader *) arg;
+    while (reader->remaining && !reader->stop.load(std::memory_order_relaxed)) {
+        uint32_t head = reader->head.load(std::memory_order_relaxed);
+        if (head - reader->tail.load(std::memory_order_acquire) == ASYNC_READER_BUFFERS) {
+            reader->freed.wait();
+            continue;
+        }
+
+        uint32_t slot = head % ASYNC_READER_BUFFERS;
+        size_t n = (reader->remaining < IO_BUFFER_SIZE) ? (size_t) reader->remaining : IO_BUFFER_SIZE;
+        if (reader->zip->m_pRead(reader->zip->m_pIO_opaque, reader->offset, reader->buffers[slot], n) != n) {
+            reader->failed = true;
+            break;
+        }
+        reader->sizes[slot] = n;
+        reader->offset += n;
+        reader->remaining -= n;
+        reader->head.store(head + 1, std::memory_order_release);
+        reader->filled.signal();
+    }
+    reader->done.store(true, std::memory_order_release);
+    reader->filled.signal();
+}
+
+const uint8_t *AsyncReader::next(size_t *size) {
+    if (!started)
+        return NULL;
+
+    uint32_t tail = this->tail.load(std::memory_order_relaxed);
+    if (holding) {
+        this->tail.store(++tail, std::memory_order_release);
+        freed.signal();
+        holding = false;
+    }
+    for (;;) {
+        if (tail != head.load(std::memory_order_acquire)) {
+            holding = true;
+            *size = sizes[tail % ASYNC_READER_BUFFERS];
+            return buffers[tail % ASYNC_READER_BUFFERS];
+        }
+        // done is only set after the last buffer was handed over
+        if (done.load(std::memory_order_acquire)) {
+            if (tail == head.load(std::memory_order_acquire))
+                return NULL;
+            continue;
+        }
+        filled.wait();
+    }
+}
+
+bool AsyncReader::finish() {
+    if (!started)
+        return !failed;
+
+    stop = true;
+    freed.signal();
+    thread.join();
+    for (int i = 0; i < ASYNC_READER_BUFFERS; i++) {
+        ioBuffers.release(buffers[i]);
+        buffers[i] = NULL;
+    }
+    started = false;
+    return !failed;
+}
+
+uint8_t *zip_load_file(const char *path, size_t limit, size_t *size) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    uint8_t *data = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0 && (uint64_t) st.st_size <= limit)
+        data = (uint8_t *) memory_alloc(MEMORY_MEM2, st.st_size, IO_BUFFER_ALIGNMENT);
+    if (!data) {
+        ::close(fd);
+        return NULL;
+    }
+
+    size_t done = 0;
+    while (done < (size_t) st.st_size) {
+        ssize_t got = ::read(fd, data + done, st.st_size - done);
+        if (got <= 0)
+            break;
+        done += got;
+    }
+    ::close(fd);
+    if (done != (size_t) st.st_size) {
+        memory_free(data);
+        return NULL;
+    }
+    *size = done;
+    return data;
+}
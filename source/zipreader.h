@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "miniz/miniz.h"
+#include "thread.h"
+
+// Reads which continue the window refill it this far ahead, anything else
+// only reads ZIP_READER_RANDOM_SIZE so a local header doesn't pull in 512 KB
+#define ZIP_READER_WINDOW_SIZE (512 * 1024) // 512 KB
+#define ZIP_READER_RANDOM_SIZE (16 * 1024)  // 16 KB
+
+// m_pRead backend for miniz. mz_zip_file_read_func() does an ftell, maybe an
+// fseek and an fread for every request, and entries are read in small
+// pieces. This serves them from a read-ahead window instead, and only seeks
+// when the archive isn't read front to back.
+class ZipReader {
+public:
+    ZipReader();
+    ~ZipReader();
+
+    bool open(const char *path);
+    void close();
+    // Points zip's reads at this reader, call before mz_zip_reader_init()
+    void install(mz_zip_archive *zip);
+    uint64_t size() const { return fileSize; }
+
+private:
+    static size_t zipRead(void *opaque, mz_uint64 ofs, void *buf, size_t n);
+    size_t readAt(uint64_t ofs, uint8_t *buf, size_t n);
+    size_t read(uint64_t ofs, uint8_t *buf, size_t n);
+
+    int fd;
+    uint64_t fileSize;
+    uint64_t filePos;
+    uint8_t *window;
+    uint64_t windowOfs;
+    size_t windowLen;
+};
+
+#define ASYNC_READER_BUFFERS 4
+
+// The read stage of an entry's pipeline. A thread reads the range through
+// zip's m_pRead into ASYNC_READER_BUFFERS buffers from ioBuffers and hands
+// them over through a single-producer single-consumer ring, so the next
+// chunk is read while the current one is inflated. Either side blocks on an
+// Event while it has to wait for the other. Nothing else may read from zip
+// until finish().
+class AsyncReader {
+public:
+    AsyncReader();
+    ~AsyncReader();
+
+    bool start(mz_zip_archive *zip, uint64_t offset, uint64_t size, int core);
+    // The next chunk, valid until the next call. NULL at the end of the
+    // range or if a read failed.
+    const uint8_t *next(size_t *size);
+    // Stops the thread, false if a read failed
+    bool finish();
+
+private:
+    static void run(void *arg);
+
+    mz_zip_archive *zip;
+    uint64_t offset;
+    uint64_t remaining;
+    Thread thread;
+    Event filled;
+    Event freed;
+    uint8_t *buffers[ASYNC_READER_BUFFERS];
+    size_t sizes[ASYNC_READER_BUFFERS];
+    // Buffers tail up to head - 1 are filled, the consumer holds tail
+    std::atomic<uint32_t> head;
+    std::atomic<uint32_t> tail;
+    std::atomic<bool> done;
+    std::atomic<bool> failed;
+    std::atomic<bool> stop;
+    bool holding;
+    bool started;
+};
+
+// Reads the whole file into an aligned MEM2 buffer if it's at most limit
+// bytes, for mz_zip_reader_init_mem(). NULL if it's bigger or doesn't fit in
+// memory. Freed with memory_free().
+uint8_t *zip_load_file(const char *path, size_t limit, size_t *size);